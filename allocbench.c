@@ -0,0 +1,71 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "kstat.h"
+
+// Page allocator throughput benchmark.  Each of nproc processes
+// repeatedly grows its heap by NPAGES pages, touches them and shrinks
+// it again, so every round is NPAGES kalloc() and NPAGES kfree()
+// calls.  Run with nproc >= number of CPUs to load every CPU.
+// Heap pages are zero-filled on first touch, so the zero pool
+// hit rate is reported too.
+
+#define NPAGES 64
+#define ROUNDS 200
+#define PGSIZE 4096
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, k, nproc;
+  int refill0, drain0, zhit0, zmiss0;
+  uint64 t0, t1;
+  uint us, pages;
+  char *a;
+
+  nproc = 4;
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+
+  refill0 = kstat(KSTAT_KREFILL);
+  drain0 = kstat(KSTAT_KDRAIN);
+  zhit0 = kstat(KSTAT_ZHIT);
+  zmiss0 = kstat(KSTAT_ZMISS);
+  clockns(&t0);
+
+  for(i = 0; i < nproc; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf(1, "allocbench: fork failed\n");
+      break;
+    }
+    if(pid == 0){
+      for(j = 0; j < ROUNDS; j++){
+        a = sbrk(NPAGES * PGSIZE);
+        if(a == (char*)-1){
+          printf(1, "allocbench: sbrk failed\n");
+          exit();
+        }
+        for(k = 0; k < NPAGES; k++)
+          a[k * PGSIZE] = 1;
+        sbrk(-NPAGES * PGSIZE);
+      }
+      exit();
+    }
+  }
+  for(i = 0; i < nproc; i++)
+    wait();
+
+  clockns(&t1);
+  us = nsdiv(t1 - t0, 1000);
+  pages = nproc * ROUNDS * NPAGES;
+  printf(1, "allocbench: %d procs, %d page alloc+free pairs in %d us\n",
+         nproc, pages, us);
+  if(us >= 1000)
+    printf(1, "  %d pairs/ms\n", pages / (us / 1000));
+  printf(1, "  kmem refills %d, drains %d\n",
+         kstat(KSTAT_KREFILL) - refill0, kstat(KSTAT_KDRAIN) - drain0);
+  printf(1, "  zeroed pages from pool %d, zeroed on demand %d\n",
+         kstat(KSTAT_ZHIT) - zhit0, kstat(KSTAT_ZMISS) - zmiss0);
+  exit();
+}
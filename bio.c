@@ -12,6 +12,8 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//     Buffer locks are adaptive (see acquireadaptive): a process
+//     waiting for a buffer spins while the holder is running.
 //
 // The implementation uses two state flags internally:
 // * B_VALID: the buffer data has been read from the disk.
@@ -33,7 +35,7 @@ struct {
   // Linked list of all buffers, through prev/next.
   // head.next is most recently used.
   struct buf head;
-} bcache;
+} bcache __attribute__((aligned(CACHELINE)));
 
 void
 binit(void)
@@ -70,7 +72,7 @@ bget(uint dev, uint blockno)
     if(b->dev == dev && b->blockno == blockno){
       b->refcnt++;
       release(&bcache.lock);
-      acquiresleep(&b->lock);
+      acquireadaptive(&b->lock);
       return b;
     }
   }
@@ -85,7 +87,7 @@ bget(uint dev, uint blockno)
       b->flags = 0;
       b->refcnt = 1;
       release(&bcache.lock);
-      acquiresleep(&b->lock);
+      acquireadaptive(&b->lock);
       return b;
     }
   }
@@ -0,0 +1,123 @@
+// System time.
+//
+// ticks counts timer interrupts on CPU 0.  It is written only by
+// clocktick() and is a single aligned word, so readers (uptime,
+// sleep, the schedulers) just load it without taking a lock.
+//
+// timebase holds the 64-bit tick count, which a 32-bit CPU cannot
+// load atomically, under a seqlock.  The writer bumps seq to an odd
+// value, updates the count and bumps it back to even; readers retry
+// until they see the same even seq before and after reading.
+//
+// nsclock() is a monotonic nanosecond clock derived from the TSC,
+// calibrated against the 8254 PIT at boot.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+
+#define PIT_HZ      1193182   // 8254 input clock
+#define CALIB_MS    10        // length of the TSC calibration window
+#define NS_SHIFT    24        // fixed-point shift for tsc -> ns scaling
+
+uint ticks;
+
+static struct {
+  volatile uint seq;
+  uint64 ticks;   // 64-bit tick count
+} timebase;
+
+static uint64 tscboot;   // TSC when clockinit() ran
+static uint tsckhz;      // measured TSC frequency
+static uint nsmult;      // ns = (tsc delta * nsmult) >> NS_SHIFT
+
+// 64-by-32 bit unsigned division.  The kernel is not linked against
+// libgcc, so plain 64-bit '/' is unavailable.
+static uint64
+div64(uint64 n, uint d)
+{
+  uint64 q, r;
+  int i;
+
+  q = r = 0;
+  for(i = 63; i >= 0; i--){
+    r = (r << 1) | ((n >> i) & 1);
+    if(r >= d){
+      r -= d;
+      q |= (uint64)1 << i;
+    }
+  }
+  return q;
+}
+
+// Measure the TSC frequency in kHz by counting cycles across
+// CALIB_MS milliseconds of PIT channel 2.
+static uint
+calibratetsc(void)
+{
+  uint latch;
+  uint64 t0, t1;
+
+  latch = PIT_HZ / (1000 / CALIB_MS);
+  outb(0x61, (inb(0x61) & ~0x02) | 0x01);  // gate on, speaker off
+  outb(0x43, 0xB0);                        // ch 2, lo/hi byte, mode 0
+  outb(0x42, latch & 0xFF);
+  outb(0x42, latch >> 8);
+  t0 = rdtsc();
+  while((inb(0x61) & 0x20) == 0)           // wait for OUT2
+    ;
+  t1 = rdtsc();
+  return (uint)(t1 - t0) / CALIB_MS;
+}
+
+void
+clockinit(void)
+{
+  tsckhz = calibratetsc();
+  if(tsckhz == 0)
+    panic("clockinit");
+  nsmult = div64((uint64)1000000 << NS_SHIFT, tsckhz);
+  tscboot = rdtsc();
+  cprintf("clock: tsc %d MHz\n", tsckhz / 1000);
+}
+
+// Called from the timer interrupt on CPU 0 only.
+void
+clocktick(void)
+{
+  timebase.seq++;
+  __sync_synchronize();
+  timebase.ticks++;
+  ticks = (uint)timebase.ticks;
+  __sync_synchronize();
+  timebase.seq++;
+}
+
+// Lock-free read of the 64-bit tick count.
+uint64
+ticks64(void)
+{
+  uint seq;
+  uint64 t;
+
+  do {
+    while((seq = timebase.seq) & 1)
+      pause();
+    __sync_synchronize();
+    t = timebase.ticks;
+    __sync_synchronize();
+  } while(timebase.seq != seq);
+  return t;
+}
+
+// Nanoseconds since clockinit().
+uint64
+nsclock(void)
+{
+  uint64 d;
+
+  d = rdtsc() - tscboot;
+  return (((uint64)(uint)d * nsmult) >> NS_SHIFT) +
+         (((d >> 32) * nsmult) << (32 - NS_SHIFT));
+}
@@ -259,7 +259,10 @@ consoleread(struct inode *ip, char *dst, int n)
       }
       break;
     }
+    // Storing to user memory may fault and sleep (swap-in).
+    release(&cons.lock);
     *dst++ = c;
+    acquire(&cons.lock);
     --n;
     if(c == '\n')
       break;
@@ -273,13 +276,20 @@ consoleread(struct inode *ip, char *dst, int n)
 int
 consolewrite(struct inode *ip, char *buf, int n)
 {
-  int i;
+  char kbuf[128];
+  int i, j, m;
 
   iunlock(ip);
-  acquire(&cons.lock);
-  for(i = 0; i < n; i++)
-    consputc(buf[i] & 0xff);
-  release(&cons.lock);
+  // Copy out of user memory without holding cons.lock, since
+  // touching it may fault and sleep to swap the page in.
+  for(i = 0; i < n; i += m){
+    m = n - i < sizeof(kbuf) ? n - i : sizeof(kbuf);
+    memmove(kbuf, buf + i, m);
+    acquire(&cons.lock);
+    for(j = 0; j < m; j++)
+      consputc(kbuf[j] & 0xff);
+    release(&cons.lock);
+  }
   ilock(ip);
 
   return n;
@@ -1,9 +1,12 @@
 struct buf;
 struct context;
+struct fdtable;
 struct file;
 struct inode;
 struct pipe;
 struct proc;
+struct vma;
+struct vmspace;
 struct rtcdate;
 struct spinlock;
 struct sleeplock;
@@ -16,6 +19,12 @@ struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 
+// clock.c
+void            clockinit(void);
+void            clocktick(void);
+uint64          nsclock(void);
+uint64          ticks64(void);
+
 // console.c
 void            consoleinit(void);
 void            cprintf(char*, ...);
@@ -24,11 +33,15 @@ void            panic(char*) __attribute__((noreturn));
 
 // exec.c
 int             exec(char*, char**);
+int             spawn(char*, char**, struct fdtable*);
 
 // file.c
 struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
+struct fdtable* fdtcopy(struct fdtable*);
+struct fdtable* fdtdup(struct fdtable*);
+void            fdtrelease(struct fdtable*);
 void            fileinit(void);
 int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
@@ -43,6 +56,7 @@ struct inode*   idup(struct inode*);
 void            iinit(int dev);
 void            ilock(struct inode*);
 void            iput(struct inode*);
+void            itext(struct inode*, int);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
@@ -53,11 +67,21 @@ int             readi(struct inode*, char*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
+// futex.c
+void            futexinit(void);
+int             futexwait(uint, uint);
+int             futexwake(uint, int);
+
 // ide.c
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
 
+// imgcache.c
+void            imginit(void);
+char*           imgget(struct inode*, uint, uint);
+void            imginfo(void);
+
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
 extern uchar    ioapicid;
@@ -66,17 +90,31 @@ void            ioapicinit(void);
 // kalloc.c
 char*           kalloc(void);
 void            kfree(char*);
+char*           kalloc_pages(int);
+void            kfree_pages(char*, int);
+void            kallocinfo(void);
+char*           kzalloc(void);
+void            kzeroidle(void);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+void            kincref(char*);
+int             krefcount(char*);
+int             kfreepages(void);
 
 // kbd.c
 void            kbdintr(void);
 
+// ksm.c
+void            ksminit(void);
+int             ksmscan(pde_t*, uint*, int);
+void            ksminfo(void);
+
 // lapic.c
 void            cmostime(struct rtcdate *r);
 int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
+void            lapicipi(int);
 void            lapicinit(void);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
@@ -87,6 +125,25 @@ void            log_write(struct buf*);
 void            begin_op();
 void            end_op();
 
+// mmap.c
+void            fcacheinit(void);
+char*           fcacheget(struct inode*, uint);
+void            fpagewrite(struct inode*, uint, char*);
+void            fcacherelease(struct inode*);
+
+// swap.c
+void            swapinit(int);
+void            swapdup(uint);
+void            swapfree(uint);
+int             swapin(pte_t*);
+char*           kallocuser(int);
+void            swapinfo(void);
+
+// memdetect.c
+extern uint     phystop;
+void            memdetect(void);
+void            memreport(void);
+
 // mp.c
 extern int      ismp;
 void            mpinit(void);
@@ -96,6 +153,7 @@ void            picenable(int);
 void            picinit(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
@@ -108,6 +166,8 @@ void            exit(void);
 int             fork(void);
 int             growproc(int);
 int             kill(int);
+int             oomkill(void);
+void            ksmidle(void);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
@@ -119,6 +179,7 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
+int             sleepticks(uint);
 void            yield(void);
 int             waitx(int*, int*);
 void            update_times();
@@ -129,10 +190,49 @@ int             top_queue(int);
 void            pop_pid_queue(int,int);
 void            q_init();
 void            proc_info();
+char*           swapvictim(uint);
+struct proc*    newchild(struct vmspace*, struct fdtable*);
+int             runchild(struct proc*);
+int             vfork(void);
+void            vforkdone(struct proc*);
+int             clone(uint, uint, uint);
+int             join(uint*);
+struct vmspace* vmsalloc(pde_t*, uint);
+struct vmspace* vmsdup(struct vmspace*);
+void            vmsrelease(struct vmspace*);
+int             vmbegin(void);
+void            vmend(int);
+struct vmspace* vmswitch(struct vmspace*);
+int             vmacopy(uint, struct vma*);
+void            tlbshootdown(void);
+void            tlbintr(void);
+
+// reclaim.c
+void            addshrinker(char*, int (*)(int));
+int             reclaim(int);
+int             oom(void);
+void            reclaiminfo(void);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
 
+// shm.c
+void            shminit(void);
+int             shmget(char*, uint);
+uint            shmsize(int);
+int             shmmap(pde_t*, int, uint);
+void            shmdup(int);
+void            shmrelease(int);
+void            shminfo(void);
+
+// slab.c
+struct kmem_cache;
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+void            slabinfo(void);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
@@ -144,6 +244,7 @@ void            popcli(void);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
+void            acquireadaptive(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
@@ -160,19 +261,21 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
-int             argstr(int, char**);
+int             argptrw(int, char**, int);
+int             argstr(int, char*, int);
 int             fetchint(uint, int*);
-int             fetchstr(uint, char**);
+int             fetchstr(uint, char*, int);
 void            syscall(void);
 
-// timer.c
-void            timerinit(void);
+// sysproc.c
+void            kstatinc(int);
+void            kstatadd(int, uint);
+uint            kstatget(int);
 
 // trap.c
 void            idtinit(void);
 extern uint     ticks;
 void            tvinit(void);
-extern struct spinlock tickslock;
 
 // uart.c
 void            uartinit(void);
@@ -188,12 +291,25 @@ int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
-int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
+int             copyinstr(char*, uint, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
+int             pagefault(uint, uint);
+int             touchuvm(uint, uint);
+pte_t*          uvmpte(pde_t*, uint);
+int             uvmresident(pde_t*, uint);
+int             mapshared(pde_t*, uint, char**, int);
+struct vma*     vmaalloc(struct proc*);
+int             vmaoverlap(struct proc*, uint, uint);
+uint            vmaspace(struct proc*, uint);
+void            vmadup(struct vma*);
+void            vmaclose(struct vma*);
+int             uvmvalid(struct proc*, uint, uint, int);
+pte_t*          clockscan(pde_t*, uint*);
+void            vmaunmap(pde_t*, struct vma*);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
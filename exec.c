@@ -3,22 +3,42 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "vmspace.h"
 #include "defs.h"
 #include "x86.h"
 #include "elf.h"
+#include "kstat.h"
 
-int
-exec(char *path, char **argv)
+// A program image built by loadimage(), not yet given to a process.
+struct image {
+  struct vmspace *vm;        // page table, one file vma per loadable segment
+  uint entry;                // first instruction
+  uint sp;                   // initial stack pointer
+  char name[16];
+};
+
+// Build the user image of the program at path, with arguments argv
+// on its stack, in a new page table.
+//
+// Program segments are not read in here.  Each loadable segment
+// becomes a vma backed by the executable's inode, and pagefault()
+// reads a page from the file the first time the program touches it.
+static int
+loadimage(char *path, char **argv, struct image *im)
 {
   char *s, *last;
-  int i, off;
+  int i, off, nvma;
   uint argc, sz, sp, ustack[3+MAXARG+1];
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
-  pde_t *pgdir, *oldpgdir;
-  struct proc *curproc = myproc();
+  struct vma vma[NVMA];
+  pde_t *pgdir;
 
+  memset(vma, 0, sizeof(vma));
+  nvma = 0;
   begin_op();
 
   if((ip = namei(path)) == 0){
@@ -38,7 +58,7 @@ exec(char *path, char **argv)
   if((pgdir = setupkvm()) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Map program segments.
   sz = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
@@ -49,12 +69,27 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr + ph.memsz >= KERNBASE)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.off + ph.filesz < ph.off)
       goto bad;
+    if(nvma == NVMA)
+      goto bad;
+    vma[nvma].type = VMA_FILE;
+    vma[nvma].start = ph.vaddr;
+    vma[nvma].end = ph.vaddr + ph.memsz;
+    vma[nvma].ip = idup(ip);
+    vma[nvma].off = ph.off;
+    vma[nvma].filesz = ph.filesz;
+    vma[nvma].writable = 1;
+    vma[nvma].shared = 0;
+    vma[nvma].text = 1;
+    itext(ip, 1);
+    nvma++;
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
   }
   iunlockput(ip);
   end_op();
@@ -91,16 +126,13 @@ exec(char *path, char **argv)
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
-  safestrcpy(curproc->name, last, sizeof(curproc->name));
-
-  // Commit to the user image.
-  oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
-  curproc->tf->eip = elf.entry;  // main
-  curproc->tf->esp = sp;
-  switchuvm(curproc);
-  freevm(oldpgdir);
+  safestrcpy(im->name, last, sizeof(im->name));
+
+  if((im->vm = vmsalloc(pgdir, sz)) == 0)
+    goto bad;
+  memmove(im->vm->vma, vma, sizeof(vma));
+  im->entry = elf.entry;
+  im->sp = sp;
   return 0;
 
  bad:
@@ -110,5 +142,68 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(nvma > 0){
+    begin_op();
+    while(nvma > 0){
+      nvma--;
+      itext(vma[nvma].ip, -1);
+      iput(vma[nvma].ip);
+    }
+    end_op();
+  }
   return -1;
 }
+
+int
+exec(char *path, char **argv)
+{
+  uint64 t0;
+  struct image im;
+  struct vmspace *oldvm;
+  struct proc *curproc = myproc();
+
+  t0 = nsclock();
+  if(loadimage(path, argv, &im) < 0)
+    return -1;
+
+  // Commit to the user image.  The old address space stays with
+  // the threads or the vfork() parent still using it, if any.
+  safestrcpy(curproc->name, im.name, sizeof(curproc->name));
+  oldvm = vmswitch(im.vm);
+  curproc->tf->eip = im.entry;  // main
+  curproc->tf->esp = im.sp;
+  curproc->execns = t0;
+  switchuvm(curproc);
+  vmsrelease(oldvm);
+  if(curproc->vforked)
+    vforkdone(curproc);
+  kstatinc(KSTAT_EXEC);
+  return 0;
+}
+
+// Start the program at path in a new child process, as fork()
+// followed by exec() in the child would, without copying the
+// current address space.  The child takes over the open file
+// table fdt, which is left to the caller if spawn() fails.
+// Returns the child's pid.
+int
+spawn(char *path, char **argv, struct fdtable *fdt)
+{
+  uint64 t0;
+  struct image im;
+  struct proc *np;
+
+  t0 = nsclock();
+  if(loadimage(path, argv, &im) < 0)
+    return -1;
+  if((np = newchild(im.vm, fdt)) == 0){
+    vmsrelease(im.vm);
+    return -1;
+  }
+  safestrcpy(np->name, im.name, sizeof(np->name));
+  np->tf->eip = im.entry;
+  np->tf->esp = im.sp;
+  np->execns = t0;
+  kstatinc(KSTAT_EXEC);
+  return runchild(np);
+}
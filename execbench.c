@@ -0,0 +1,74 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "kstat.h"
+
+// Exec latency benchmark.  Runs a program NEXEC times and reports
+// the average time from exec() to its first instruction (measured
+// by the kernel, KSTAT_EXECNS) and how many pages were read from
+// the file per run, against the size of the binary.
+//
+// The default target is usertests.  usertests stops right away if
+// usertests.ran exists, so that file is created for the run and
+// removed again afterwards if it was not there before.
+
+#define NEXEC  20
+#define PGSIZE 4096
+
+int
+main(int argc, char *argv[])
+{
+  char *path, *args[2];
+  struct stat st;
+  uint e0, ns0, pg0, execs, ns, pg;
+  int i, fd, pid, made;
+
+  path = argc > 1 ? argv[1] : "usertests";
+  if((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0){
+    printf(1, "execbench: cannot stat %s\n", path);
+    exit();
+  }
+  close(fd);
+
+  made = 0;
+  if((fd = open("usertests.ran", O_RDONLY)) < 0){
+    close(open("usertests.ran", O_CREATE));
+    made = 1;
+  } else
+    close(fd);
+
+  args[0] = path;
+  args[1] = 0;
+  e0 = kstat(KSTAT_EXEC);
+  ns0 = kstat(KSTAT_EXECNS);
+  pg0 = kstat(KSTAT_FILEPG);
+  for(i = 0; i < NEXEC; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "execbench: fork failed\n");
+      break;
+    }
+    if(pid == 0){
+      exec(path, args);
+      printf(2, "execbench: exec %s failed\n", path);
+      exit();
+    }
+    wait();
+  }
+  execs = kstat(KSTAT_EXEC) - e0;
+  ns = kstat(KSTAT_EXECNS) - ns0;
+  pg = kstat(KSTAT_FILEPG) - pg0;
+
+  if(made)
+    unlink("usertests.ran");
+  if(execs == 0){
+    printf(1, "execbench: no exec succeeded\n");
+    exit();
+  }
+  printf(1, "execbench: %s, %d KB (%d pages), %d execs\n",
+         path, st.size / 1024, (st.size + PGSIZE - 1) / PGSIZE, execs);
+  printf(1, "  exec to first instruction: %d us\n", ns / execs / 1000);
+  printf(1, "  pages read from file per run: %d\n", pg / execs);
+  exit();
+}
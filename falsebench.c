@@ -0,0 +1,112 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+
+// False sharing.  First, n threads (argv[1], default 4) each
+// increment their own counter ITER times, once with the counters
+// next to each other in one cache line and once with a cache line
+// per counter; the difference is what sharing a line costs.  Then
+// n processes each fault in and free a heap page NOPS times, which
+// goes through the per-CPU page caches, kernel counters and struct
+// proc; if those do not share lines between CPUs, n processes take
+// about as long per page as one.  Run with CPUS >= n.
+
+#define ITER   (1 << 22)
+#define NOPS   2000
+#define MAXTHR 8
+#define PGSIZE 4096
+
+volatile uint packed[MAXTHR];
+
+struct {
+  volatile uint n;
+} __attribute__((aligned(CACHELINE))) padded[MAXTHR];
+
+void
+count(void *arg)
+{
+  volatile uint *c = arg;
+  int i;
+
+  for(i = 0; i < ITER; i++)
+    (*c)++;
+}
+
+// Time count() on n threads, on packed or padded counters.
+// Returns microseconds.
+uint
+runcount(int n, int pad)
+{
+  uint64 t0, t1;
+  int i;
+
+  clockns(&t0);
+  for(i = 1; i < n; i++){
+    if(thread_create(count, pad ? (void*)&padded[i].n : (void*)&packed[i]) < 0){
+      printf(1, "falsebench: thread_create failed\n");
+      exit();
+    }
+  }
+  count(pad ? (void*)&padded[0].n : (void*)&packed[0]);
+  for(i = 1; i < n; i++)
+    thread_join();
+  clockns(&t1);
+  return nsdiv(t1 - t0, 1000);
+}
+
+// Time NOPS page fault and free rounds in each of n processes.
+// Returns microseconds per round.
+uint
+runfault(int n)
+{
+  uint64 t0, t1;
+  char *p;
+  int i, j;
+
+  clockns(&t0);
+  for(i = 0; i < n; i++){
+    if((j = fork()) < 0){
+      printf(1, "falsebench: fork failed\n");
+      exit();
+    }
+    if(j == 0){
+      for(j = 0; j < NOPS; j++){
+        p = sbrk(PGSIZE);
+        p[0] = 1;
+        sbrk(-PGSIZE);
+      }
+      exit();
+    }
+  }
+  for(i = 0; i < n; i++)
+    wait();
+  clockns(&t1);
+  return nsdiv(t1 - t0, 1000 * NOPS);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n;
+  uint shared, apart, one, many;
+
+  n = argc > 1 ? atoi(argv[1]) : 4;
+  if(n < 2 || n > MAXTHR){
+    printf(2, "usage: falsebench [threads, 2 to %d]\n", MAXTHR);
+    exit();
+  }
+  shared = runcount(n, 0);
+  apart = runcount(n, 1);
+  printf(1, "%d threads, counters in one line: %d us, a line each: %d us",
+         n, shared, apart);
+  if(apart > 0)
+    printf(1, " (%d.%dx)", shared / apart, shared * 10 / apart % 10);
+  printf(1, "\n");
+
+  one = runfault(1);
+  many = runfault(n);
+  printf(1, "page fault and free: 1 process %d us, %d processes %d us per page\n",
+         one, n, many);
+  exit();
+}
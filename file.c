@@ -16,10 +16,13 @@ struct {
   struct file file[NFILE];
 } ftable;
 
+static struct kmem_cache *fdtcache;
+
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  fdtcache = kmem_cache_create("fdtable", sizeof(struct fdtable), 0);
 }
 
 // Allocate a file structure.
@@ -79,6 +82,56 @@ fileclose(struct file *f)
   }
 }
 
+// Allocate an open file table holding new references to the files
+// open in t, or an empty one if t is 0.
+struct fdtable*
+fdtcopy(struct fdtable *t)
+{
+  struct fdtable *nt;
+  int fd;
+
+  if((nt = kmem_cache_alloc(fdtcache)) == 0)
+    return 0;
+  initlock(&nt->lock, "fdtable");
+  nt->ref = 1;
+  memset(nt->ofile, 0, sizeof(nt->ofile));
+  if(t){
+    acquire(&t->lock);
+    for(fd = 0; fd < NOFILE; fd++)
+      if(t->ofile[fd])
+        nt->ofile[fd] = filedup(t->ofile[fd]);
+    release(&t->lock);
+  }
+  return nt;
+}
+
+// Take another reference to t (clone).
+struct fdtable*
+fdtdup(struct fdtable *t)
+{
+  acquire(&t->lock);
+  t->ref++;
+  release(&t->lock);
+  return t;
+}
+
+// Drop a reference to t.  The last one closes the files.
+void
+fdtrelease(struct fdtable *t)
+{
+  int fd, ref;
+
+  acquire(&t->lock);
+  ref = --t->ref;
+  release(&t->lock);
+  if(ref > 0)
+    return;
+  for(fd = 0; fd < NOFILE; fd++)
+    if(t->ofile[fd])
+      fileclose(t->ofile[fd]);
+  kmem_cache_free(fdtcache, t);
+}
+
 // Get metadata about file f.
 int
 filestat(struct file *f, struct stat *st)
@@ -8,6 +8,12 @@ struct file {
   uint off;
 };
 
+// Open file table of a process, shared by its threads.
+struct fdtable {
+  struct spinlock lock;
+  int ref;                     // processes using the table
+  struct file *ofile[NOFILE];
+};
 
 // in-memory copy of an inode
 struct inode {
@@ -16,6 +22,8 @@ struct inode {
   int ref;            // Reference count
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  uint gen;           // changes when the contents may have (imgcache.c)
+  int ntext;          // exec() mappings of the file; it cannot be written while > 0
 
   short type;         // copy of disk inode
   short major;
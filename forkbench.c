@@ -0,0 +1,68 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Fork latency benchmark.  For growing heap sizes, time NFORK
+// fork()+exit()+wait() cycles and NFORK fork()+exec()+wait() cycles.
+// With copy-on-write fork the cost follows the number of page-table
+// entries to copy, not the amount of memory behind them.
+
+#define NFORK  50
+#define PGSIZE 4096
+
+int sizes[] = { 0, 1024*1024, 4*1024*1024, 16*1024*1024 };
+
+uint
+timefork(int doexec)
+{
+  char *argv[] = { "forkbench", "-exit", 0 };
+  uint64 t0, t1;
+  int i, pid;
+
+  clockns(&t0);
+  for(i = 0; i < NFORK; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "forkbench: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      if(doexec)
+        exec(argv[0], argv);
+      exit();
+    }
+    wait();
+  }
+  clockns(&t1);
+  return nsdiv(t1 - t0, 1000 * NFORK);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, n;
+  uint have;
+  char *a;
+
+  if(argc > 1 && strcmp(argv[1], "-exit") == 0)
+    exit();
+
+  printf(1, "heap KB   fork us   fork+exec us\n");
+  have = 0;
+  for(i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++){
+    n = sizes[i] - have;
+    if(n > 0){
+      if((a = sbrk(n)) == (char*)-1){
+        printf(1, "forkbench: sbrk %d failed\n", n);
+        break;
+      }
+      // Touch the memory so it is really there to be copied.
+      for(; n > 0; n -= PGSIZE, a += PGSIZE)
+        *a = 1;
+      have = sizes[i];
+    }
+    printf(1, "%d       %d        %d\n", sizes[i] / 1024,
+           timefork(0), timefork(1));
+  }
+  exit();
+}
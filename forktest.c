@@ -4,8 +4,9 @@
 #include "types.h"
 #include "stat.h"
 #include "user.h"
+#include "param.h"
 
-#define N  1000
+#define N  NPROC
 
 void
 printf(int fd, const char *s, ...)
@@ -187,6 +187,15 @@ iinit(int dev)
 
 static struct inode* iget(uint dev, uint inum);
 
+// A generation number no inode has had yet.
+static uint
+newgen(void)
+{
+  static uint gen;
+
+  return __sync_add_and_fetch(&gen, 1);
+}
+
 //PAGEBREAK!
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
@@ -266,6 +275,7 @@ iget(uint dev, uint inum)
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->gen = newgen();
   release(&icache.lock);
 
   return ip;
@@ -431,9 +441,18 @@ itrunc(struct inode *ip)
   }
 
   ip->size = 0;
+  ip->gen = newgen();
   iupdate(ip);
 }
 
+// Count n more exec() mappings of ip, or -n fewer.  While there
+// are any, the file cannot be written (writei()).
+void
+itext(struct inode *ip, int n)
+{
+  __sync_fetch_and_add(&ip->ntext, n);
+}
+
 // Copy stat information from inode.
 // Caller must hold ip->lock.
 void
@@ -494,6 +513,11 @@ writei(struct inode *ip, char *src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  // A running program faults its pages in from the file as it
+  // touches them: changing the file under it would make it run a
+  // mix of old and new pages.
+  if(ip->ntext > 0)
+    return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
@@ -507,6 +531,8 @@ writei(struct inode *ip, char *src, uint off, uint n)
     ip->size = off;
     iupdate(ip);
   }
+  if(n > 0)
+    ip->gen = newgen();
   return n;
 }
 
@@ -0,0 +1,179 @@
+// Futexes: sleeping on a word of user memory.
+//
+// futex_wait(addr, val) sleeps if the word at addr still holds val,
+// and futex_wake(addr, n) wakes up to n processes sleeping on addr.
+// User-space locks keep their state in the word and only call into
+// the kernel when they have to wait or someone is waiting; see the
+// mutex and condition variable in thread.c.
+//
+// A futex is named by the physical page and offset of the word when
+// the page is PTE_SHARED (shm_open(), MAP_SHARED), so that every
+// process mapping it finds the same futex.  Private pages can move
+// (copy-on-write, swapping), so a word in one is named by the page
+// directory and virtual address instead, which threads share.
+// Waiters are kept on NFUTEXQ hashed queues, each with its own lock.
+// The value check in futex_wait() happens under the queue lock, so
+// a waker that changes the word and then calls futex_wake() cannot
+// slip in between the check and the sleep.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "kstat.h"
+
+#define NFUTEXQ 64   // wait queues; a power of 2
+
+struct fkey {
+  pde_t *pgdir;      // 0 for a shared page
+  uint addr;         // physical address if shared, else virtual
+};
+
+struct waiter {
+  struct fkey key;
+  int woken;
+  struct waiter *next;
+};
+
+struct futexq {
+  struct spinlock lock;
+  struct waiter *head;
+};
+
+static struct futexq futexq[NFUTEXQ];
+
+void
+futexinit(void)
+{
+  int i;
+
+  for(i = 0; i < NFUTEXQ; i++)
+    initlock(&futexq[i].lock, "futex");
+}
+
+// Name the word at va in p.  Returns the PTE value of its page,
+// or 0 if the page is not present.
+static pte_t
+futexkey(struct proc *p, uint va, struct fkey *k)
+{
+  pte_t *pte;
+
+  if((pte = uvmpte(p->pgdir, va)) == 0 || (*pte & (PTE_P|PTE_U)) != (PTE_P|PTE_U))
+    return 0;
+  if(*pte & PTE_SHARED){
+    k->pgdir = 0;
+    k->addr = PTE_ADDR(*pte) | (va & (PGSIZE-1));
+  } else {
+    k->pgdir = p->pgdir;
+    k->addr = va;
+  }
+  return *pte;
+}
+
+static struct futexq*
+hashq(struct fkey *k)
+{
+  return &futexq[((uint)k->pgdir ^ (k->addr >> 2)) % NFUTEXQ];
+}
+
+// Find the futex for va, faulting the page in if needed, and return
+// its queue locked, with the PTE of the word's page in *ptep.  The
+// page stays mapped while this process runs and holds the lock, so
+// it cannot be swapped out; a thread unmapping it at the same time
+// is the caller's race to lose.
+// Returns 0 if va is not a valid word of user memory or the
+// process has been killed.
+static struct futexq*
+lookup(uint va, struct fkey *k, pte_t *ptep)
+{
+  struct proc *curproc = myproc();
+  struct futexq *q;
+  struct fkey k1;
+  pte_t *pte;
+
+  if(va % sizeof(uint) || !uvmvalid(curproc, va, sizeof(uint), 0))
+    return 0;
+  for(;;){
+    if(curproc->killed || touchuvm(va, sizeof(uint)) < 0)
+      return 0;
+    if(futexkey(curproc, va, k) == 0){
+      // A page that is present but not a user page, such as the
+      // stack guard page, will never do.  One that is not present
+      // was swapped out or unmapped again meanwhile: try again.
+      if((pte = uvmpte(curproc->pgdir, va)) != 0 && (*pte & PTE_P))
+        return 0;
+      continue;
+    }
+    q = hashq(k);
+    acquire(&q->lock);
+    // Another thread may have unmapped or moved the page meanwhile.
+    if((*ptep = futexkey(curproc, va, &k1)) != 0 &&
+       k1.pgdir == k->pgdir && k1.addr == k->addr)
+      return q;
+    release(&q->lock);
+  }
+}
+
+// Sleep on the word at va if it holds val.  Returns 0 when woken
+// (callers must recheck the word: wakeups may be spurious), or -1 if
+// the word does not hold val, va is invalid or the process is killed.
+int
+futexwait(uint va, uint val)
+{
+  struct proc *curproc = myproc();
+  struct futexq *q;
+  struct waiter w, **pp;
+  pte_t pte;
+
+  if((q = lookup(va, &w.key, &pte)) == 0)
+    return -1;
+  if(*(uint*)(P2V(PTE_ADDR(pte)) + (va & (PGSIZE-1))) != val){
+    release(&q->lock);
+    return -1;
+  }
+  w.woken = 0;
+  w.next = q->head;
+  q->head = &w;
+  kstatinc(KSTAT_FUTEXWAIT);
+  while(!w.woken && !curproc->killed)
+    sleep(&w, &q->lock);
+  if(!w.woken){
+    for(pp = &q->head; *pp != &w; pp = &(*pp)->next)
+      ;
+    *pp = w.next;
+  }
+  release(&q->lock);
+  return w.woken ? 0 : -1;
+}
+
+// Wake up to n processes sleeping on the word at va.
+// Returns the number woken, or -1 if va is invalid.
+int
+futexwake(uint va, int n)
+{
+  struct futexq *q;
+  struct waiter *w, **pp;
+  struct fkey k;
+  pte_t pte;
+  int woken;
+
+  if((q = lookup(va, &k, &pte)) == 0)
+    return -1;
+  woken = 0;
+  for(pp = &q->head; (w = *pp) != 0 && woken < n; ){
+    if(w->key.pgdir != k.pgdir || w->key.addr != k.addr){
+      pp = &w->next;
+      continue;
+    }
+    *pp = w->next;
+    w->woken = 1;
+    wakeup(w);
+    woken++;
+  }
+  release(&q->lock);
+  kstatadd(KSTAT_FUTEXWAKE, woken);
+  return woken;
+}
@@ -0,0 +1,90 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "kstat.h"
+
+// Handoff latency between two threads.  The threads pass a turn
+// back and forth N times; each waits for its turn by spinning, by
+// polling with sleep(1), or with futex_wait(), and the futex version
+// wakes the other side with futex_wake().  Prints the time per
+// handoff and how often a thread slept in futex_wait().
+//
+// Spinning is fastest when each thread has its own CPU (make qemu
+// CPUS=2) and slowest when they share one, since a spinner only
+// gives up the CPU at the end of its time slice.  sleep(1) costs a
+// timer tick per handoff.
+
+#define N       2000
+#define NSLEEP  20          // sleep(1) is slow: fewer rounds
+
+enum { SPIN, SLEEP, FUTEX };
+
+volatile uint turn;         // whose turn it is: 0 or 1
+int how, rounds;
+
+void
+await(uint me)
+{
+  while(turn != me){
+    if(how == SLEEP)
+      sleep(1);
+    else if(how == FUTEX)
+      futex_wait(&turn, !me);
+  }
+}
+
+void
+pass(uint me)
+{
+  turn = !me;
+  if(how == FUTEX)
+    futex_wake(&turn, 1);
+}
+
+void
+partner(void *arg)
+{
+  int i;
+
+  for(i = 0; i < rounds; i++){
+    await(1);
+    pass(1);
+  }
+}
+
+void
+handoff(char *what, int h, int n)
+{
+  uint64 t0, t1;
+  uint waits, ns;
+  int i;
+
+  how = h;
+  rounds = n;
+  turn = 0;
+  waits = kstat(KSTAT_FUTEXWAIT);
+  clockns(&t0);
+  if(thread_create(partner, 0) < 0){
+    printf(1, "futexbench: thread_create failed\n");
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    pass(0);
+    await(0);
+  }
+  clockns(&t1);
+  thread_join();
+  waits = kstat(KSTAT_FUTEXWAIT) - waits;
+  ns = nsdiv(t1 - t0, 2*n);
+  printf(1, "%s: %d handoffs, %d ns each, %d futex sleeps\n",
+         what, 2*n, ns, waits);
+}
+
+int
+main(void)
+{
+  handoff("spin ", SPIN, N);
+  handoff("sleep", SLEEP, NSLEEP);
+  handoff("futex", FUTEX, N);
+  exit();
+}
@@ -0,0 +1,173 @@
+// Program image cache.
+//
+// exec() maps each loadable segment of a program as a private file
+// mapping, and pagefault() used to read every page into a fresh
+// page for every process.  Now the page read from the file is kept
+// here, keyed by (dev, inum, generation, offset, length), and every
+// process running the program maps that one physical page: read-only
+// in a read-only segment, and copy-on-write (PTE_COW) in a writable
+// one, so the first write gets a private copy.  Text is never
+// written and stays shared.  Private mmap()s go through here too.
+//
+// An inode's generation (ip->gen) changes whenever its contents may
+// have (writei(), itrunc()) or it is read in afresh, so a modified
+// file misses the cache instead of being served stale pages.  A
+// program cannot be modified while it runs, though: its pages are
+// faulted in from the file as they are first touched, so it would
+// run a mix of old and new ones.  exec() counts its mappings in
+// ip->ntext, and writei() and writable shared mmap()s of the file
+// fail while there are any.  No
+// one looks for the stale entries again; like unused ones, they are
+// recycled once no process maps their page, or freed when memory runs
+// low.  The cache holds a reference on each page and every mapping
+// one more.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "kstat.h"
+
+#define NIMG 256   // pages cached at once
+
+struct imgpage {
+  uint dev;
+  uint inum;
+  uint gen;
+  uint off;        // file offset of the page's contents
+  uint n;          // bytes from the file; the rest is zero
+  char *page;      // 0 if the slot is free
+};
+
+static struct {
+  struct sleeplock lock;
+  struct imgpage pg[NIMG];
+  int hand;        // next slot to consider recycling
+} img;
+
+static int imgshrink(int);
+
+void
+imginit(void)
+{
+  initsleeplock(&img.lock, "imgcache");
+  addshrinker("imgcache", imgshrink);
+}
+
+// A slot for a new page: a free one, or one whose page no process
+// maps.  Returns 0 if all are in use.  Caller holds img.lock.
+static struct imgpage*
+imgslot(void)
+{
+  struct imgpage *e;
+  int i;
+
+  for(i = 0; i < NIMG; i++){
+    e = &img.pg[img.hand];
+    img.hand = (img.hand + 1) % NIMG;
+    if(e->page && krefcount(e->page) == 1){
+      kfree(e->page);
+      e->page = 0;
+    }
+    if(e->page == 0)
+      return e;
+  }
+  return 0;
+}
+
+// Return a page holding n bytes of ip from off followed by zeros,
+// with a reference for the caller's mapping.  Returns 0 if out of
+// memory or the file cannot be read.  ip must not be locked.
+char*
+imgget(struct inode *ip, uint off, uint n)
+{
+  struct imgpage *e;
+  char *mem;
+
+  // Allocate before taking any lock: kallocuser() may run the
+  // shrinkers, which take locks of their own.
+  if((mem = kallocuser(0)) == 0)
+    return 0;
+  acquiresleep(&img.lock);
+  ilock(ip);
+  for(e = img.pg; e < &img.pg[NIMG]; e++){
+    if(e->page && e->dev == ip->dev && e->inum == ip->inum &&
+       e->gen == ip->gen && e->off == off && e->n == n){
+      kincref(e->page);
+      iunlock(ip);
+      releasesleep(&img.lock);
+      kfree(mem);
+      kstatinc(KSTAT_IMGHIT);
+      return e->page;
+    }
+  }
+  if(readi(ip, mem, off, n) != n){
+    iunlock(ip);
+    releasesleep(&img.lock);
+    kfree(mem);
+    return 0;
+  }
+  kstatinc(KSTAT_FILEPG);
+  memset(mem + n, 0, PGSIZE - n);
+  if((e = imgslot()) != 0){
+    e->dev = ip->dev;
+    e->inum = ip->inum;
+    e->gen = ip->gen;
+    e->off = off;
+    e->n = n;
+    e->page = mem;
+    kincref(mem);
+  }
+  iunlock(ip);
+  releasesleep(&img.lock);
+  return mem;
+}
+
+// Shrinker: free the cached pages no process maps.
+static int
+imgshrink(int n)
+{
+  struct imgpage *e;
+  int freed;
+
+  if(holdingsleep(&img.lock))
+    return 0;
+  freed = 0;
+  acquiresleep(&img.lock);
+  for(e = img.pg; e < &img.pg[NIMG]; e++){
+    if(e->page && krefcount(e->page) == 1){
+      kfree(e->page);
+      e->page = 0;
+      freed++;
+    }
+  }
+  releasesleep(&img.lock);
+  return freed;
+}
+
+// Print how many pages are cached and how many of them are mapped.
+void
+imginfo(void)
+{
+  struct imgpage *e;
+  int n, mapped, maps;
+
+  n = mapped = maps = 0;
+  acquiresleep(&img.lock);
+  for(e = img.pg; e < &img.pg[NIMG]; e++){
+    if(e->page){
+      n++;
+      if(krefcount(e->page) > 1){
+        mapped++;
+        maps += krefcount(e->page) - 1;
+      }
+    }
+  }
+  releasesleep(&img.lock);
+  cprintf("imgcache: %d of %d pages cached, %d mapped %d times\n",
+          n, NIMG, mapped, maps);
+}
@@ -1,6 +1,28 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers.
+//
+// Physical memory is managed by a binary buddy allocator: a free
+// block of order k is 2^k physically contiguous pages, aligned to
+// its size.  kalloc_pages(order) splits a larger block if no block
+// of the right order is free; kfree_pages() merges a freed block
+// with its buddy (the other half of the next larger block) for as
+// long as the buddy is free too.
+//
+// Single pages (order 0) are by far the most common request, so
+// kalloc() and kfree() normally touch only a small per-CPU cache
+// (kcpus); pages move between a cache and the buddy lists KBATCH
+// at a time, so kmem.lock is taken once per batch.
+//
+// Idle CPUs keep a pool of pages that are already zero (zpool), so
+// that kzalloc() can usually skip the memset.  Freed pages are only
+// filled with junk when the kernel is built with KDEBUG.
+//
+// Every allocated block has a reference count, kept for its first
+// page, so that a physical page can be mapped by several page
+// tables (copy-on-write fork).  Allocation returns a block with one
+// reference; freeing drops a reference and only returns the block
+// to the allocator when the last one is gone.
 
 #include "types.h"
 #include "defs.h"
@@ -8,31 +30,84 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "kstat.h"
+
+#define KCACHE  64   // most pages a CPU cache holds before draining
+#define KBATCH  32   // pages moved per refill or drain
+#define ZPOOL  128   // zeroed pages kept ready by idle CPUs
 
 void freerange(void *vstart, void *vend);
+static char *zpooltake(void);
+static void zpooldrain(void);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
 struct run {
   struct run *next;
+  struct run *prev;
 };
 
+// The lock-protected structures below each start a cache line, so
+// that taking one lock does not pull in a line another CPU is
+// writing for a different one.
 struct {
   struct spinlock lock;
   int use_lock;
+  struct run *free[MAXORDER+1];   // free blocks of each order
+  uint nfree[MAXORDER+1];         // length of each free list
+} kmem __attribute__((aligned(CACHELINE)));
+
+// Per-CPU page cache.  The lock is almost always taken by its own
+// CPU; other CPUs take it only to steal pages when memory is short.
+// Padded to a cache line so neighbouring CPUs' caches do not share.
+struct kcpu {
+  struct spinlock lock;
   struct run *freelist;
-} kmem;
+  int n;
+} __attribute__((aligned(CACHELINE))) kcpus[NCPU];
+
+// Pages zeroed ahead of time.  They are allocated pages (one
+// reference each) linked through their first word, which is
+// cleared again when a page leaves the pool.
+struct {
+  struct spinlock lock;
+  struct run *list;
+  int n;
+} zpool __attribute__((aligned(CACHELINE)));
+
+// Reference counts, indexed by physical page number.  Like
+// pgorder, sized for phystop and placed just after the kernel by
+// kinit1().
+static uint *pgref;
+
+// For the first page of each free buddy block, its order plus one;
+// zero for all other pages.
+static uchar *pgorder;
 
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
 // 2. main() calls kinit2() with the rest of the physical pages
 // after installing a full page table that maps them on all cores.
+// memdetect() must have set phystop.
 void
 kinit1(void *vstart, void *vend)
 {
+  uint npages;
+  int i;
+
   initlock(&kmem.lock, "kmem");
+  initlock(&zpool.lock, "zpool");
+  for(i = 0; i < NCPU; i++)
+    initlock(&kcpus[i].lock, "kcpu");
   kmem.use_lock = 0;
+  npages = phystop / PGSIZE;
+  pgref = (uint*)PGROUNDUP((uint)vstart);
+  pgorder = (uchar*)(pgref + npages);
+  vstart = pgorder + npages;
+  if((char*)vstart + PGSIZE > (char*)vend)
+    panic("kinit1: page arrays");
+  memset(pgref, 0, (char*)vstart - (char*)pgref);
   freerange(vstart, vend);
 }
 
@@ -51,7 +126,210 @@ freerange(void *vstart, void *vend)
   for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
     kfree(p);
 }
+
+//PAGEBREAK: 30
+// Buddy lists.  Callers hold kmem.lock (or are still booting).
+
+static void
+pushblock(struct run *r, int order)
+{
+  r->prev = 0;
+  r->next = kmem.free[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.free[order] = r;
+  kmem.nfree[order]++;
+  pgorder[V2P(r)/PGSIZE] = order + 1;
+}
+
+static void
+removeblock(struct run *r, int order)
+{
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.free[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.nfree[order]--;
+  pgorder[V2P(r)/PGSIZE] = 0;
+}
+
+// Take a block of 2^order pages, splitting a larger one if needed.
+static struct run*
+buddyalloc(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k <= MAXORDER && kmem.free[k] == 0; k++)
+    ;
+  if(k > MAXORDER)
+    return 0;
+  r = kmem.free[k];
+  removeblock(r, k);
+  // Give back the upper halves until the block is the right size.
+  while(k > order){
+    k--;
+    pushblock((struct run*)((char*)r + (PGSIZE << k)), k);
+  }
+  return r;
+}
+
+// Return a block of 2^order pages, merging it with free buddies.
+static void
+buddyfree(struct run *r, int order)
+{
+  uint pa, buddy;
+
+  pa = V2P(r);
+  while(order < MAXORDER){
+    buddy = pa ^ (PGSIZE << order);
+    if(buddy >= phystop || pgorder[buddy/PGSIZE] != order + 1)
+      break;
+    removeblock((struct run*)P2V(buddy), order);
+    if(buddy < pa)
+      pa = buddy;
+    order++;
+  }
+  pushblock((struct run*)P2V(pa), order);
+}
+
+// Move up to KBATCH pages from the buddy lists to c.
+// Caller holds c->lock.
+static void
+refill(struct kcpu *c)
+{
+  struct run *r;
+  int i;
+
+  kstatinc(KSTAT_KREFILL);
+  acquire(&kmem.lock);
+  for(i = 0; i < KBATCH && (r = buddyalloc(0)) != 0; i++){
+    r->next = c->freelist;
+    c->freelist = r;
+    c->n++;
+  }
+  release(&kmem.lock);
+}
+
+// Move n pages from c back to the buddy lists.
+// Caller holds c->lock.
+static void
+drain(struct kcpu *c, int n)
+{
+  struct run *r;
+
+  kstatinc(KSTAT_KDRAIN);
+  acquire(&kmem.lock);
+  for(; n > 0; n--){
+    r = c->freelist;
+    c->freelist = r->next;
+    c->n--;
+    buddyfree(r, 0);
+  }
+  release(&kmem.lock);
+}
+
+// Take one page from another CPU's cache.  Used when both the
+// local cache and the buddy lists are empty.
+static struct run*
+steal(struct kcpu *self)
+{
+  struct kcpu *c;
+  struct run *r;
+
+  for(c = kcpus; c < &kcpus[NCPU]; c++){
+    if(c == self || c->n == 0)
+      continue;
+    acquire(&c->lock);
+    if((r = c->freelist) != 0){
+      c->freelist = r->next;
+      c->n--;
+    }
+    release(&c->lock);
+    if(r)
+      return r;
+  }
+  return 0;
+}
+
+// Return every CPU's cached pages to the buddy lists so that they
+// can merge into larger blocks.
+static void
+drainall(void)
+{
+  struct kcpu *c;
+
+  for(c = kcpus; c < &kcpus[NCPU]; c++){
+    if(c->n == 0)
+      continue;
+    acquire(&c->lock);
+    if(c->n > 0)
+      drain(c, c->n);
+    release(&c->lock);
+  }
+}
+
 //PAGEBREAK: 21
+// Free the block of 2^order pages of physical memory pointed at
+// by v, which normally should have been returned by a call to
+// kalloc_pages(order).
+void
+kfree_pages(char *v, int order)
+{
+  if(order < 0 || order > MAXORDER)
+    panic("kfree_pages: order");
+  if((uint)v % (PGSIZE << order) || v < end || V2P(v) >= phystop)
+    panic("kfree_pages");
+  if(order == 0){
+    kfree(v);
+    return;
+  }
+  if(pgref[V2P(v)/PGSIZE] == 0)
+    panic("kfree_pages: not allocated");
+  if(__sync_sub_and_fetch(&pgref[V2P(v)/PGSIZE], 1) != 0)
+    return;
+
+#ifdef KDEBUG
+  // Fill with junk to catch dangling refs.
+  memset(v, 1, PGSIZE << order);
+#endif
+
+  acquire(&kmem.lock);
+  buddyfree((struct run*)v, order);
+  release(&kmem.lock);
+}
+
+// Allocate 2^order physically contiguous pages, aligned to their
+// size.  Returns a pointer that the kernel can use, or 0 if no
+// block that large is free.
+char*
+kalloc_pages(int order)
+{
+  struct run *r;
+
+  if(order < 0 || order > MAXORDER)
+    return 0;
+  if(order == 0)
+    return kalloc();
+  acquire(&kmem.lock);
+  r = buddyalloc(order);
+  release(&kmem.lock);
+  if(r == 0){
+    // Single pages parked in CPU caches or the zero pool may
+    // complete a block.
+    zpooldrain();
+    drainall();
+    acquire(&kmem.lock);
+    r = buddyalloc(order);
+    release(&kmem.lock);
+  }
+  if(r)
+    pgref[V2P(r)/PGSIZE] = 1;
+  return (char*)r;
+}
+
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
@@ -60,20 +338,40 @@ void
 kfree(char *v)
 {
   struct run *r;
+  struct kcpu *c;
 
-  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+  if((uint)v % PGSIZE || v < end || V2P(v) >= phystop)
     panic("kfree");
 
+  // Pages handed over by kinit have no references yet.
+  if(kmem.use_lock){
+    if(pgref[V2P(v)/PGSIZE] == 0)
+      panic("kfree: not allocated");
+    if(__sync_sub_and_fetch(&pgref[V2P(v)/PGSIZE], 1) != 0)
+      return;
+  }
+
+#ifdef KDEBUG
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+  if(!kmem.use_lock){
+    // Still booting on one CPU: straight into the buddy lists.
+    buddyfree(r, 0);
+    return;
+  }
+
+  pushcli();
+  c = &kcpus[cpuid()];
+  acquire(&c->lock);
+  r->next = c->freelist;
+  c->freelist = r;
+  if(++c->n > KCACHE)
+    drain(c, KBATCH);
+  release(&c->lock);
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -83,14 +381,154 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kcpu *c;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
+  if(!kmem.use_lock){
+    r = buddyalloc(0);
+    if(r)
+      pgref[V2P(r)/PGSIZE] = 1;
+    return (char*)r;
+  }
+
+  pushcli();
+  c = &kcpus[cpuid()];
+  acquire(&c->lock);
+  if(c->n == 0)
+    refill(c);
+  if((r = c->freelist) != 0){
+    c->freelist = r->next;
+    c->n--;
+  }
+  release(&c->lock);
+  if(r == 0)
+    r = steal(c);
+  popcli();
   if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+    pgref[V2P(r)/PGSIZE] = 1;
+  else
+    r = (struct run*)zpooltake();
   return (char*)r;
 }
 
+// Take a page from the zero pool, or return 0 if it is empty.
+static char*
+zpooltake(void)
+{
+  struct run *r;
+
+  if(zpool.n == 0)
+    return 0;
+  acquire(&zpool.lock);
+  if((r = zpool.list) != 0){
+    zpool.list = r->next;
+    zpool.n--;
+  }
+  release(&zpool.lock);
+  if(r)
+    r->next = 0;
+  return (char*)r;
+}
+
+// Give every page in the zero pool back to the allocator.
+static void
+zpooldrain(void)
+{
+  char *mem;
+
+  while((mem = zpooltake()) != 0)
+    kfree(mem);
+}
+
+// Allocate one zeroed page, from the zero pool if possible.
+char*
+kzalloc(void)
+{
+  char *mem;
+
+  if((mem = zpooltake()) != 0){
+    kstatinc(KSTAT_ZHIT);
+    return mem;
+  }
+  kstatinc(KSTAT_ZMISS);
+  if((mem = kalloc()) != 0)
+    memset(mem, 0, PGSIZE);
+  return mem;
+}
+
+// Zero one free page into the zero pool if it is not full.
+// Called by the scheduler when it finds nothing to run.
+void
+kzeroidle(void)
+{
+  struct run *r;
+
+  if(!kmem.use_lock || zpool.n >= ZPOOL)
+    return;
+  if((r = (struct run*)kalloc()) == 0)
+    return;
+  memset(r, 0, PGSIZE);
+  acquire(&zpool.lock);
+  r->next = zpool.list;
+  zpool.list = r;
+  zpool.n++;
+  release(&zpool.lock);
+}
+
+// Add a reference to the allocated page v.
+void
+kincref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= phystop)
+    panic("kincref");
+  __sync_fetch_and_add(&pgref[V2P(v)/PGSIZE], 1);
+}
+
+// Number of references to the allocated page v.
+int
+krefcount(char *v)
+{
+  return pgref[V2P(v)/PGSIZE];
+}
+
+// Number of free pages, including the CPU caches and the zero
+// pool.  Read without locks, so only approximate.
+int
+kfreepages(void)
+{
+  int k, n;
+
+  n = zpool.n;
+  for(k = 0; k < NCPU; k++)
+    n += kcpus[k].n;
+  for(k = 0; k <= MAXORDER; k++)
+    n += kmem.nfree[k] << k;
+  return n;
+}
+
+// Print free memory by block order.  "unusable" is the share of
+// free memory that sits in blocks too small for a request of that
+// order: the fragmentation a multi-page allocation runs into.
+void
+kallocinfo(void)
+{
+  uint free, small;
+  int k, cached;
+
+  cached = 0;
+  for(k = 0; k < NCPU; k++)
+    cached += kcpus[k].n;
+  acquire(&kmem.lock);
+  free = 0;
+  for(k = 0; k <= MAXORDER; k++)
+    free += kmem.nfree[k] << k;
+  cprintf("buddy: %d free pages (%d KB), %d more in CPU caches, %d zeroed\n",
+          free, free * (PGSIZE/1024), cached, zpool.n);
+  small = 0;
+  for(k = 0; k <= MAXORDER; k++){
+    cprintf("buddy order %d (%d KB): %d free blocks, %d%% unusable\n",
+            k, (PGSIZE/1024) << k, kmem.nfree[k],
+            free ? small * 100 / free : 0);
+    small += kmem.nfree[k] << k;
+  }
+  release(&kmem.lock);
+}
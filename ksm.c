@@ -0,0 +1,183 @@
+// Same-page merging.
+//
+// Idle CPUs scan the user pages of processes that are not running
+// (ksmidle() in proc.c), KSMBATCH pages per clock tick, and merge
+// pages with identical contents into one physical page, shared the
+// way fork() shares memory: a writable page loses PTE_W and gains
+// PTE_COW, so the first write to it gets a private copy back
+// (cowpage()).  Read-only pages, such as program text that exec()
+// read in for every copy of a program, just share the page.
+//
+// Candidates meet in a table indexed by a hash of the page contents.
+// A slot holds either a hint, the last page seen with that hash,
+// or a stable page that merged PTEs map.  A page equal to a hint
+// becomes stable itself, made read-only where it is mapped; a page
+// equal to a stable page is remapped to it and freed.  The table
+// holds a reference on stable pages but not on hints, which are
+// only compared against, never mapped.  A stable page nobody maps
+// any more is dropped when the scan comes across its slot or when
+// memory runs low.
+//
+// Shared pages (PTE_SHARED) are left alone, and merged pages, being
+// mapped more than once, are not swapped out.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "kstat.h"
+
+#define NKSM 256   // hash table slots
+
+struct ksmslot {
+  uint hash;
+  char *page;      // 0 if empty
+  int stable;      // page is merged, and the table holds a reference
+};
+
+static struct {
+  struct spinlock lock;
+  struct ksmslot slot[NKSM];
+} ksm;
+
+static int ksmshrink(int);
+
+void
+ksminit(void)
+{
+  initlock(&ksm.lock, "ksm");
+  addshrinker("ksm", ksmshrink);
+}
+
+static uint
+pagehash(char *page)
+{
+  uint *w, h;
+
+  h = 2166136261u;
+  for(w = (uint*)page; w < (uint*)(page + PGSIZE); w++)
+    h = (h ^ *w) * 16777619;
+  return h;
+}
+
+// Flags for a merged mapping of a page mapped with pte.
+static uint
+ksmflags(pte_t pte)
+{
+  if(pte & PTE_W)
+    return (PTE_FLAGS(pte) & ~PTE_W) | PTE_COW;
+  return PTE_FLAGS(pte);
+}
+
+// Drop the stable page in e if nobody maps it.  Caller holds ksm.lock.
+static int
+ksmdrop(struct ksmslot *e)
+{
+  if(!e->stable || krefcount(e->page) != 1)
+    return 0;
+  kfree(e->page);
+  e->page = 0;
+  e->stable = 0;
+  return 1;
+}
+
+// Try to merge the page that pte maps.  The page table's owner is
+// not running.  Faults sleeping in its page table install PTEs with
+// compare-and-swap, and so does this, so neither overwrites the other.
+static void
+ksmpage(pte_t *pte)
+{
+  struct ksmslot *e;
+  pte_t old;
+  char *page;
+  uint h;
+
+  old = *pte;
+  page = P2V(PTE_ADDR(old));
+  h = pagehash(page);
+  kstatinc(KSTAT_KSMSCAN);
+  e = &ksm.slot[h % NKSM];
+  acquire(&ksm.lock);
+  ksmdrop(e);
+  if(e->page == 0 || e->page == page || e->hash != h ||
+     memcmp(e->page, page, PGSIZE) != 0){
+    if(!e->stable){
+      e->hash = h;
+      e->page = page;
+    }
+  } else if(e->stable){
+    if(__sync_bool_compare_and_swap(pte, old, V2P(e->page) | ksmflags(old))){
+      kincref(e->page);
+      kfree(page);
+      kstatinc(KSTAT_KSMMERGE);
+    }
+  } else if(__sync_bool_compare_and_swap(pte, old, PTE_ADDR(old) | ksmflags(old))){
+    kincref(page);
+    e->page = page;
+    e->stable = 1;
+  }
+  release(&ksm.lock);
+}
+
+// Scan up to n of the user pages of pgdir from *va on.  Returns 1
+// with *va at the next page to look at, or 0 at the end of user
+// space.  The caller holds ptable.lock and has checked that pgdir
+// is in use by no running process.
+int
+ksmscan(pde_t *pgdir, uint *va, int n)
+{
+  pte_t *pte;
+  uint a;
+
+  for(a = *va; a < KERNBASE; a += PGSIZE){
+    if((pte = uvmpte(pgdir, a)) == 0){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if((*pte & (PTE_P|PTE_U|PTE_SHARED)) != (PTE_P|PTE_U))
+      continue;
+    if(n-- == 0){
+      *va = a;
+      return 1;
+    }
+    ksmpage(pte);
+  }
+  return 0;
+}
+
+// Shrinker: free the stable pages nobody maps.
+static int
+ksmshrink(int n)
+{
+  struct ksmslot *e;
+  int freed;
+
+  freed = 0;
+  acquire(&ksm.lock);
+  for(e = ksm.slot; e < &ksm.slot[NKSM]; e++)
+    freed += ksmdrop(e);
+  release(&ksm.lock);
+  return freed;
+}
+
+// Print the merged pages and the memory they save.
+void
+ksminfo(void)
+{
+  struct ksmslot *e;
+  int nstable, nmap;
+
+  nstable = nmap = 0;
+  acquire(&ksm.lock);
+  for(e = ksm.slot; e < &ksm.slot[NKSM]; e++){
+    if(e->stable){
+      nstable++;
+      nmap += krefcount(e->page) - 1;
+    }
+  }
+  release(&ksm.lock);
+  cprintf("ksm: %d merged pages mapped %d times, %d pages saved\n",
+          nstable, nmap, nmap - nstable);
+}
@@ -0,0 +1,56 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "kstat.h"
+
+// Same-page merging at work.  Starts N copies of a process that
+// fills NPAGES heap pages with the same contents as every other copy
+// (each page different from the others in the process) and then
+// sleeps, and reports once a second how many pages the merger has
+// looked at and merged.  At the end it prints mem_info, whose ksm
+// line shows the pages saved.
+
+#define N       8
+#define NPAGES  64
+#define PGSIZE  4096
+#define SECS    5
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, n, pids[N];
+  uint scan0, merge0;
+  char *p;
+
+  n = argc > 1 ? atoi(argv[1]) : N;
+  if(n < 1 || n > N){
+    printf(2, "usage: ksmbench [copies <= %d]\n", N);
+    exit();
+  }
+  scan0 = kstat(KSTAT_KSMSCAN);
+  merge0 = kstat(KSTAT_KSMMERGE);
+  for(i = 0; i < n; i++){
+    if((pids[i] = fork()) < 0){
+      printf(1, "ksmbench: fork failed\n");
+      exit();
+    }
+    if(pids[i] == 0){
+      p = sbrk(NPAGES * PGSIZE);
+      for(j = 0; j < NPAGES * PGSIZE; j++)
+        p[j] = j / PGSIZE + j % 7;
+      for(;;)
+        sleep(1000);
+    }
+  }
+  for(i = 1; i <= SECS; i++){
+    sleep(100);
+    printf(1, "%d s: %d pages scanned, %d merged\n", i,
+           kstat(KSTAT_KSMSCAN) - scan0, kstat(KSTAT_KSMMERGE) - merge0);
+  }
+  mem_info();
+  for(i = 0; i < n; i++){
+    kill(pids[i]);
+    wait();
+  }
+  exit();
+}
@@ -0,0 +1,23 @@
+// Kernel event counters, read from user space with kstat(id).
+#define KSTAT_SWTCH       0  // Context switches out of a process (sched)
+#define KSTAT_LOCKSPIN    1  // Adaptive sleep-lock acquisitions won by spinning
+#define KSTAT_LOCKSLEEP   2  // Times a sleep-lock acquirer had to sleep
+#define KSTAT_KREFILL     3  // Per-CPU page cache refills from kmem
+#define KSTAT_KDRAIN      4  // Per-CPU page cache drains to kmem
+#define KSTAT_EXEC        5  // Successful exec() calls
+#define KSTAT_EXECNS      6  // ns from exec() to the first instruction, summed (wraps)
+#define KSTAT_FILEPG      7  // Pages read in from files by page faults
+#define KSTAT_ZHIT        8  // kzalloc() calls served from the zero pool
+#define KSTAT_ZMISS       9  // kzalloc() calls that had to zero a page
+#define KSTAT_SWAPOUT    10  // Pages written out to swap
+#define KSTAT_SWAPIN     11  // Pages read back from swap by page faults
+#define KSTAT_FUTEXWAIT  12  // futex_wait() calls that went to sleep
+#define KSTAT_FUTEXWAKE  13  // Waiters woken by futex_wake()
+#define KSTAT_LOWMEM     14  // User allocations that found memory below SWAPLOW
+#define KSTAT_RECLAIM    15  // Pages freed by shrinkers
+#define KSTAT_OOMKILL    16  // Processes killed by the OOM killer
+#define KSTAT_KSMSCAN    17  // Pages looked at by the same-page merger
+#define KSTAT_KSMMERGE   18  // Pages merged into an identical page and freed
+#define KSTAT_IMGHIT     19  // File page faults served by the image cache
+#define KSTAT_FREEPG     20  // Free pages right now (a gauge, not a counter)
+#define NKSTAT           21
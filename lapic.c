@@ -26,6 +26,7 @@
   #define DEASSERT   0x00000000
   #define LEVEL      0x00008000   // Level triggered
   #define BCAST      0x00080000   // Send to all APICs, including self.
+  #define OTHERS     0x000C0000   // Send to all APICs, excluding self.
   #define BUSY       0x00001000
   #define FIXED      0x00000000
 #define ICRHI   (0x0310/4)   // Interrupt Command [63:32]
@@ -113,6 +114,18 @@ lapiceoi(void)
     lapicw(EOI, 0);
 }
 
+// Send interrupt vector to all other CPUs.
+void
+lapicipi(int vector)
+{
+  if(!lapic)
+    return;
+  lapicw(ICRHI, 0);
+  lapicw(ICRLO, OTHERS | FIXED | vector);
+  while(lapic[ICRLO] & DELIVS)
+    ;
+}
+
 // Spin for a given number of microseconds.
 // On real hardware would want to tune this dynamically.
 void
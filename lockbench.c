@@ -0,0 +1,96 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "kstat.h"
+
+// Contended buffer-lock benchmark.  Each process opens, reads and
+// closes a file of its own in a directory of its own, so no two
+// share an inode lock.  The files are created one after another and
+// their inodes sit in the same inode block, which every open reads
+// (a closed file's inode is read in afresh), so the processes keep
+// meeting on that block's struct buf lock in bio.c.  Reports
+// elapsed ticks, context switches and how many lock acquisitions
+// were won by spinning instead of sleeping.
+
+#define ROUNDS 2000
+#define MAXPROC 8
+
+char dir[] = "lbd0";
+char file[] = "lbd0/f";
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, fd, nproc, start;
+  int swtch0, spin0, sleep0;
+  char buf[512];
+
+  nproc = 4;
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+  if(nproc < 1 || nproc > MAXPROC){
+    printf(2, "usage: lockbench [nproc <= %d]\n", MAXPROC);
+    exit();
+  }
+
+  // Directories first, so that the files' inodes are consecutive.
+  memset(buf, 'x', sizeof(buf));
+  for(i = 0; i < nproc; i++){
+    dir[3] = '0' + i;
+    mkdir(dir);
+  }
+  for(i = 0; i < nproc; i++){
+    file[3] = '0' + i;
+    if((fd = open(file, O_CREATE|O_RDWR)) < 0){
+      printf(1, "lockbench: cannot create %s\n", file);
+      exit();
+    }
+    write(fd, buf, sizeof(buf));
+    close(fd);
+  }
+
+  swtch0 = kstat(KSTAT_SWTCH);
+  spin0 = kstat(KSTAT_LOCKSPIN);
+  sleep0 = kstat(KSTAT_LOCKSLEEP);
+  start = uptime();
+
+  for(i = 0; i < nproc; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf(1, "lockbench: fork failed\n");
+      break;
+    }
+    if(pid == 0){
+      dir[3] = '0' + i;
+      if(chdir(dir) < 0){
+        printf(1, "lockbench: cannot chdir to %s\n", dir);
+        exit();
+      }
+      for(j = 0; j < ROUNDS; j++){
+        if((fd = open("f", O_RDONLY)) < 0){
+          printf(1, "lockbench: cannot open %s/f\n", dir);
+          exit();
+        }
+        read(fd, buf, sizeof(buf));
+        close(fd);
+      }
+      exit();
+    }
+  }
+  for(i = 0; i < nproc; i++)
+    wait();
+
+  printf(1, "lockbench: %d procs x %d rounds in %d ticks\n",
+         nproc, ROUNDS, uptime() - start);
+  printf(1, "  context switches  %d\n", kstat(KSTAT_SWTCH) - swtch0);
+  printf(1, "  spin acquisitions %d\n", kstat(KSTAT_LOCKSPIN) - spin0);
+  printf(1, "  sleep waits       %d\n", kstat(KSTAT_LOCKSLEEP) - sleep0);
+
+  for(i = 0; i < nproc; i++){
+    file[3] = dir[3] = '0' + i;
+    unlink(file);
+    unlink(dir);
+  }
+  exit();
+}
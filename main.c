@@ -17,7 +17,9 @@ extern char end[]; // first address after kernel loaded from ELF file
 int
 main(void)
 {
+  memdetect();     // size of physical memory
   kinit1(end, P2V(4*1024*1024)); // phys page allocator
+  slabinit();      // kernel object caches
   kvmalloc();      // kernel page table
   mpinit();        // detect other processors
   lapicinit();     // interrupt controller
@@ -26,6 +28,7 @@ main(void)
   ioapicinit();    // another interrupt controller
   consoleinit();   // console hardware
   uartinit();      // serial port
+  clockinit();     // calibrate TSC clock
   #if SCHEDULER == SCHED_MLFQ
   q_init();
   #endif
@@ -33,9 +36,16 @@ main(void)
   tvinit();        // trap vectors
   binit();         // buffer cache
   fileinit();      // file table
+  pipeinit();      // pipe cache
+  shminit();       // shared memory segments
+  fcacheinit();    // shared file page cache
+  futexinit();     // futex wait queues
+  ksminit();       // same-page merging
+  imginit();       // program image cache
   ideinit();       // disk 
   startothers();   // start other processors
-  kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  kinit2(P2V(4*1024*1024), P2V(phystop)); // must come after startothers()
+  memreport();     // print the memory layout
   userinit();      // first user process
   mpmain();        // finish this processor's setup
 }
@@ -84,7 +94,7 @@ startothers(void)
     // Tell entryother.S what stack to use, where to enter, and what
     // pgdir to use. We cannot use kpgdir yet, because the AP processor
     // is running in low  memory, so we use entrypgdir for the APs too.
-    stack = kalloc();
+    stack = kalloc_pages(KSTACKORDER);
     *(void**)(code-4) = stack + KSTACKSIZE;
     *(void(**)(void))(code-8) = mpenter;
     *(int**)(code-12) = (void *) V2P(entrypgdir);
@@ -0,0 +1,112 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// malloc() microbenchmarks.  Each test prints the time per
+// operation and how far it grew the heap (sbrk(0)):
+//
+//   small    malloc(32) and free() in a loop
+//   mixed    NLIVE live blocks of 1..1024 bytes, one freed and
+//            replaced at random per operation
+//   large    NLARGE live blocks of 4KB..64KB, the same way
+//   realloc  a buffer grown 64 bytes at a time to 256KB
+//   return   heap given back to the kernel after freeing 4MB of
+//            large blocks
+
+#define NSMALL  20000
+#define NLIVE   1000
+#define NMIXED  20000
+#define NLARGE  64
+#define NBIG    2000
+#define NGROW   4096
+
+static uint seed = 1;
+char *live[NLIVE];
+
+uint
+rnd(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+uint64 t0;
+char *brk0;
+
+void
+start(void)
+{
+  brk0 = sbrk(0);
+  clockns(&t0);
+}
+
+void
+stop(char *what, int n)
+{
+  uint64 t1;
+
+  clockns(&t1);
+  printf(1, "%s: %d ops, %d ns each, heap +%d KB\n", what, n,
+         nsdiv(t1 - t0, n), (sbrk(0) - brk0) / 1024);
+}
+
+void
+churn(char *what, int nlive, int n, uint min, uint max)
+{
+  int i, k;
+
+  start();
+  for(i = 0; i < nlive; i++)
+    if((live[i] = malloc(min + rnd() % (max - min + 1))) == 0)
+      goto fail;
+  for(i = 0; i < n; i++){
+    k = rnd() % nlive;
+    free(live[k]);
+    if((live[k] = malloc(min + rnd() % (max - min + 1))) == 0)
+      goto fail;
+  }
+  stop(what, nlive + n);
+  for(i = 0; i < nlive; i++)
+    free(live[i]);
+  return;
+fail:
+  printf(1, "mallocbench: %s: out of memory\n", what);
+  exit();
+}
+
+int
+main(void)
+{
+  char *p, *q, *top;
+  int i;
+
+  start();
+  for(i = 0; i < NSMALL; i++)
+    free(malloc(32));
+  stop("small  ", NSMALL);
+
+  churn("mixed  ", NLIVE, NMIXED, 1, 1024);
+  churn("large  ", NLARGE, NBIG, 4096, 65536);
+
+  start();
+  p = 0;
+  for(i = 1; i <= NGROW; i++){
+    if((q = realloc(p, i * 64)) == 0){
+      printf(1, "mallocbench: realloc: out of memory\n");
+      exit();
+    }
+    q[i*64 - 1] = 1;
+    p = q;
+  }
+  stop("realloc", NGROW);
+  free(p);
+
+  for(i = 0; i < NLARGE; i++)
+    live[i] = malloc(65536);
+  top = sbrk(0);
+  for(i = 0; i < NLARGE; i++)
+    free(live[i]);
+  printf(1, "return : freed %d KB, heap shrank by %d KB\n",
+         NLARGE * 64, (top - (char*)sbrk(0)) / 1024);
+  exit();
+}
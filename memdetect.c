@@ -0,0 +1,122 @@
+// Physical memory detection.
+//
+// bootasm.S asks the BIOS for its memory map (E820) before leaving
+// real mode and leaves it at E820MAP.  The kernel uses the usable
+// region that starts at or below EXTMEM (1MB), from its start up to
+// phystop; memory beyond a hole, and anything above PHYSMAX, which
+// would not fit in the kernel's direct map below DEVSPACE, is
+// highmem and is left alone.  If the map is missing (a multiboot
+// loader started the kernel) the CMOS memory size is used instead.
+//
+// memdetect() runs first thing in main(), before there is a console,
+// so the layout is printed later by memreport().
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+
+#define NE820     32          // most map entries believed
+#define E820_RAM  1           // usable memory
+
+#define CMOS_PORT    0x70
+#define CMOS_RETURN  0x71
+
+struct e820 {
+  uint64 addr;
+  uint64 len;
+  uint type;
+} __attribute__((packed));
+
+uint phystop;                 // top of the memory the kernel uses
+
+static struct e820 map[NE820];
+static int nmap;              // 0 if the size came from the CMOS
+static uint64 highmem;        // usable bytes the kernel leaves alone
+
+static uint
+cmos_read(uint reg)
+{
+  outb(CMOS_PORT, reg);
+  return inb(CMOS_RETURN);
+}
+
+// Copy the BIOS map out of low memory.  Returns the number of
+// entries, or 0 if there is no believable map.
+static int
+readmap(void)
+{
+  uint end, n;
+
+  end = *(ushort*)P2V(E820MAP);
+  if(end < E820MAP+4 || (end - (E820MAP+4)) % sizeof(struct e820) != 0)
+    return 0;
+  n = (end - (E820MAP+4)) / sizeof(struct e820);
+  if(n > NE820)
+    return 0;
+  memmove(map, P2V(E820MAP+4), n * sizeof(struct e820));
+  return n;
+}
+
+// Memory size from the CMOS: KB above 1MB up to 64MB, and 64KB
+// blocks above 16MB.
+static uint64
+cmostop(void)
+{
+  uint ext, high;
+
+  ext = cmos_read(0x17) | (cmos_read(0x18) << 8);
+  high = cmos_read(0x34) | (cmos_read(0x35) << 8);
+  if(high)
+    return 16*1024*1024 + (uint64)high * 64*1024;
+  return EXTMEM + (uint64)ext * 1024;
+}
+
+void
+memdetect(void)
+{
+  uint64 top, end, start;
+  int i;
+
+  top = 0;
+  if((nmap = readmap()) > 0){
+    for(i = 0; i < nmap; i++){
+      end = map[i].addr + map[i].len;
+      if(map[i].type == E820_RAM && map[i].addr <= EXTMEM && end > top)
+        top = end;
+    }
+  } else
+    top = cmostop();
+  phystop = top > PHYSMAX ? PHYSMAX : top;
+  phystop = PGROUNDDOWN(phystop);
+  if(phystop < 8*1024*1024)
+    panic("memdetect: less than 8MB of memory");
+
+  // Usable memory the kernel does not map.
+  if(nmap == 0)
+    highmem = top - phystop;
+  for(i = 0; i < nmap; i++){
+    start = map[i].addr;
+    end = map[i].addr + map[i].len;
+    if(map[i].type != E820_RAM || end <= phystop)
+      continue;
+    highmem += end - (start > phystop ? start : phystop);
+  }
+}
+
+// Print the memory layout found by memdetect().
+void
+memreport(void)
+{
+  struct e820 *e;
+
+  for(e = map; e < &map[nmap]; e++)
+    cprintf("e820: %d KB - %d KB %s\n",
+            (uint)(e->addr >> 10), (uint)((e->addr + e->len) >> 10),
+            e->type == E820_RAM ? "usable" : "reserved");
+  cprintf("mem: %d MB from %s, mapped at 0x%x-0x%x, %d MB highmem unused\n",
+          phystop >> 20, nmap ? "e820" : "cmos", KERNBASE, KERNBASE + phystop,
+          (uint)(highmem >> 20));
+}
@@ -0,0 +1,56 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "kstat.h"
+
+// Run memory out.  A child grows its heap and touches every page
+// until it is killed or its allocation fails, with swap filling up
+// on the way; the parent reports how far it got and the memory
+// pressure events this caused: allocations below the low
+// watermark, pages reclaimed from kernel caches, pages swapped out
+// and OOM kills.  Run mem_info afterwards for the details.
+
+#define PGSIZE 4096
+#define STEP   (1024*1024)
+
+int
+main(void)
+{
+  int fds[2], pid;
+  uint lowmem, reclaimed, swapped, killed, mb;
+  char *p, *q;
+
+  lowmem = kstat(KSTAT_LOWMEM);
+  reclaimed = kstat(KSTAT_RECLAIM);
+  swapped = kstat(KSTAT_SWAPOUT);
+  killed = kstat(KSTAT_OOMKILL);
+  if(pipe(fds) < 0){
+    printf(1, "memhog: pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "memhog: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(mb = 1; (p = sbrk(STEP)) != (char*)-1; mb++){
+      for(q = p; q < p + STEP; q += PGSIZE)
+        *q = 1;
+      write(fds[1], &mb, sizeof(mb));
+    }
+    exit();
+  }
+  close(fds[1]);
+  mb = 0;
+  while(read(fds[0], &mb, sizeof(mb)) == sizeof(mb))
+    ;
+  wait();
+  printf(1, "memhog: child touched %d MB\n", mb);
+  printf(1, "%d low-memory allocations, %d pages reclaimed, %d swapped out, "
+         "%d OOM kills\n", kstat(KSTAT_LOWMEM) - lowmem,
+         kstat(KSTAT_RECLAIM) - reclaimed, kstat(KSTAT_SWAPOUT) - swapped,
+         kstat(KSTAT_OOMKILL) - killed);
+  exit();
+}
@@ -1,8 +1,9 @@
 // Memory layout
 
+#define E820MAP 0x500               // BIOS memory map left by bootasm.S
 #define EXTMEM  0x100000            // Start of extended memory
-#define PHYSTOP 0xE000000           // Top physical memory
 #define DEVSPACE 0xFE000000         // Other devices are at high addresses
+#define PHYSMAX (DEVSPACE-KERNBASE) // Most physical memory the kernel can map
 
 // Key addresses for address space layout (see kmap in vm.c for layout)
 #define KERNBASE 0x80000000         // First kernel virtual address
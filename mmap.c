@@ -0,0 +1,169 @@
+// Shared file mappings.
+//
+// Pages of MAP_SHARED mappings come from a small cache of file pages
+// keyed by (inode, offset), so that every process mapping the same
+// part of a file maps the same physical page.  The cache holds one
+// kalloc reference on each page and every mapping one more.  When a
+// mapping goes away its dirty pages are written back to the file
+// through the log (fpagewrite), and pages nobody maps any more leave
+// the cache (fcacherelease).
+//
+// Cache entries do not hold inode references: a page can only be in
+// the cache while some vma maps it, and the vma holds the inode.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "kstat.h"
+
+#define NFPAGE 128   // shared file pages cached at once
+
+struct fpage {
+  struct inode *ip;   // 0 if the slot is free
+  uint off;           // page-aligned file offset
+  char *page;
+};
+
+struct {
+  struct sleeplock lock;
+  struct fpage pg[NFPAGE];
+} fcache;
+
+static int fcacheshrink(int);
+
+void
+fcacheinit(void)
+{
+  initsleeplock(&fcache.lock, "fcache");
+  addshrinker("fcache", fcacheshrink);
+}
+
+// Free the cached pages that are no longer mapped.  Returns the
+// number freed.  Caller holds fcache.lock.
+static int
+fcacheevict(struct inode *ip)
+{
+  struct fpage *f;
+  int n;
+
+  n = 0;
+  for(f = fcache.pg; f < &fcache.pg[NFPAGE]; f++){
+    if(f->ip && (ip == 0 || f->ip == ip) && krefcount(f->page) == 1){
+      kfree(f->page);
+      f->ip = 0;
+      n++;
+    }
+  }
+  return n;
+}
+
+// Shrinker: free the unmapped pages.  Skipped when this process
+// already holds the cache lock, in fcacheget().
+static int
+fcacheshrink(int n)
+{
+  if(holdingsleep(&fcache.lock))
+    return 0;
+  acquiresleep(&fcache.lock);
+  n = fcacheevict(0);
+  releasesleep(&fcache.lock);
+  return n;
+}
+
+// Return the cached page holding the file page at off of ip,
+// reading it in if needed, with an extra reference for the
+// caller's mapping.  Returns 0 if out of memory or cache slots.
+char*
+fcacheget(struct inode *ip, uint off)
+{
+  struct fpage *f, *free;
+  uint n;
+
+  acquiresleep(&fcache.lock);
+  free = 0;
+  for(f = fcache.pg; f < &fcache.pg[NFPAGE]; f++){
+    if(f->ip == ip && f->off == off){
+      kincref(f->page);
+      releasesleep(&fcache.lock);
+      return f->page;
+    }
+    if(f->ip == 0 && free == 0)
+      free = f;
+  }
+  if(free == 0){
+    fcacheevict(0);
+    for(f = fcache.pg; f < &fcache.pg[NFPAGE]; f++)
+      if(f->ip == 0)
+        break;
+    if(f == &fcache.pg[NFPAGE]){
+      releasesleep(&fcache.lock);
+      return 0;
+    }
+    free = f;
+  }
+  if((free->page = kallocuser(0)) == 0){
+    releasesleep(&fcache.lock);
+    return 0;
+  }
+  ilock(ip);
+  n = 0;
+  if(off < ip->size){
+    n = ip->size - off;
+    if(n > PGSIZE)
+      n = PGSIZE;
+    if(readi(ip, free->page, off, n) != n){
+      iunlock(ip);
+      kfree(free->page);
+      releasesleep(&fcache.lock);
+      return 0;
+    }
+    kstatinc(KSTAT_FILEPG);
+  }
+  iunlock(ip);
+  memset(free->page + n, 0, PGSIZE - n);
+  free->ip = ip;
+  free->off = off;
+  kincref(free->page);
+  releasesleep(&fcache.lock);
+  return free->page;
+}
+
+// Write page, which caches the file page at off of ip, back to
+// the file.  Only the part inside the file is written: a mapping
+// never makes a file longer.
+void
+fpagewrite(struct inode *ip, uint off, char *page)
+{
+  // Same transaction size limit as filewrite().
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+  uint i, n, n1;
+
+  for(i = 0; i < PGSIZE; i += n1){
+    begin_op();
+    ilock(ip);
+    n = off + i < ip->size ? ip->size - (off + i) : 0;
+    n1 = n < max ? n : max;
+    if(n1 > PGSIZE - i)
+      n1 = PGSIZE - i;
+    if(n1 > 0)
+      writei(ip, page + i, off + i, n1);
+    iunlock(ip);
+    end_op();
+    if(n1 == 0)
+      break;
+  }
+}
+
+// A mapping of ip went away: drop the pages nobody maps any more.
+void
+fcacherelease(struct inode *ip)
+{
+  acquiresleep(&fcache.lock);
+  fcacheevict(ip);
+  releasesleep(&fcache.lock);
+}
@@ -0,0 +1,130 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+// Sequential scan of a file: read() against mmap().
+// Builds a FILESZ-byte file, then sums every byte of it ROUNDS times
+// with read() into a small and a page-sized buffer, and through a
+// private and a shared mapping.
+//
+// read() copies each byte out of the buffer cache and takes the
+// inode lock once per call.  A mapping takes one page fault per page
+// and then reads the page in place; a shared mapping's pages stay in
+// the file page cache between rounds while other mappings hold them.
+
+#define FILESZ  (64*1024)
+#define ROUNDS  20
+
+char buf[4096];
+
+uint
+sum(char *p, int n)
+{
+  uint s;
+  int i;
+
+  s = 0;
+  for(i = 0; i < n; i++)
+    s += (uchar)p[i];
+  return s;
+}
+
+void
+report(char *what, uint64 t0, uint64 t1, uint s)
+{
+  uint us;
+
+  us = nsdiv(t1 - t0, 1000);
+  printf(1, "%s: %d KB in %d us, %d KB/s, checksum %x\n", what,
+         ROUNDS * FILESZ / 1024, us,
+         (ROUNDS * FILESZ / 1024) * 1000 / (us / 1000 + 1), s);
+}
+
+void
+readbench(char *what, int chunk)
+{
+  int fd, r, n;
+  uint s;
+  uint64 t0, t1;
+
+  s = 0;
+  clockns(&t0);
+  for(r = 0; r < ROUNDS; r++){
+    if((fd = open("mmapbench.tmp", O_RDONLY)) < 0){
+      printf(1, "mmapbench: open failed\n");
+      exit();
+    }
+    while((n = read(fd, buf, chunk)) > 0)
+      s += sum(buf, n);
+    close(fd);
+  }
+  clockns(&t1);
+  report(what, t0, t1, s);
+}
+
+void
+mapbench(char *what, int flags)
+{
+  int fd, keep, r;
+  char *p, *k;
+  uint s;
+  uint64 t0, t1;
+
+  if((fd = open("mmapbench.tmp", O_RDONLY)) < 0){
+    printf(1, "mmapbench: open failed\n");
+    exit();
+  }
+  // A mapping held across rounds, as another process would.
+  keep = flags == MAP_SHARED;
+  k = 0;
+  if(keep){
+    if((k = mmap(fd, 0, FILESZ, PROT_READ, flags)) == (char*)-1){
+      printf(1, "mmapbench: mmap failed\n");
+      exit();
+    }
+    sum(k, FILESZ);
+  }
+  s = 0;
+  clockns(&t0);
+  for(r = 0; r < ROUNDS; r++){
+    if((p = mmap(fd, 0, FILESZ, PROT_READ, flags)) == (char*)-1){
+      printf(1, "mmapbench: mmap failed\n");
+      exit();
+    }
+    s += sum(p, FILESZ);
+    munmap(p, FILESZ);
+  }
+  clockns(&t1);
+  if(keep)
+    munmap(k, FILESZ);
+  close(fd);
+  report(what, t0, t1, s);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i;
+
+  if((fd = open("mmapbench.tmp", O_CREATE|O_RDWR)) < 0){
+    printf(1, "mmapbench: create failed\n");
+    exit();
+  }
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = i * 7;
+  for(i = 0; i < FILESZ; i += sizeof(buf)){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(1, "mmapbench: write failed\n");
+      exit();
+    }
+  }
+  close(fd);
+
+  readbench("read 512", 512);
+  readbench("read 4096", 4096);
+  mapbench("mmap private", MAP_PRIVATE);
+  mapbench("mmap shared", MAP_SHARED);
+  unlink("mmapbench.tmp");
+  exit();
+}
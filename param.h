@@ -1,14 +1,25 @@
-#define NPROC        64  // maximum number of processes
-#define KSTACKSIZE 4096  // size of per-process kernel stack
+#define NPROC      4096  // maximum number of processes (allocated as needed)
+#define KSTACKORDER   1  // kernel stacks are 2^KSTACKORDER pages (kalloc_pages)
+#define KSTACKSIZE (4096 << KSTACKORDER)  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
+#define CACHELINE    64  // bytes in a cache line
 #define NOFILE       16  // open files per process
+#define NVMA          8  // mapped regions per process
+#define NSHM         16  // shared memory segments per system
+#define SHMPAGES     64  // maximum pages in a shared memory segment
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define MAXPATH     128  // maximum file path name
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define MAXORDER     10  // largest buddy block is 2^MAXORDER pages
+#define FSSIZE       2000  // size of file system in blocks
+#define SWAPSIZE    16384  // blocks of swap space after the file system
+#define SWAPLOW        32  // free pages kept for the kernel by swapping
+#define OOMLOW         16  // free pages kept for the kernel by the OOM killer
+#define KSMBATCH       32  // pages the same-page merger scans per tick
 
@@ -19,6 +19,14 @@ struct pipe {
   int writeopen;  // write fd is still open
 };
 
+static struct kmem_cache *pipecache;
+
+void
+pipeinit(void)
+{
+  pipecache = kmem_cache_create("pipe", sizeof(struct pipe), CACHELINE);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,7 +36,7 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((p = (struct pipe*)kalloc()) == 0)
+  if((p = kmem_cache_alloc(pipecache)) == 0)
     goto bad;
   p->readopen = 1;
   p->writeopen = 1;
@@ -48,7 +56,7 @@ pipealloc(struct file **f0, struct file **f1)
 //PAGEBREAK: 20
  bad:
   if(p)
-    kfree((char*)p);
+    kmem_cache_free(pipecache, p);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -69,7 +77,7 @@ pipeclose(struct pipe *p, int writable)
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
-    kfree((char*)p);
+    kmem_cache_free(pipecache, p);
   } else
     release(&p->lock);
 }
@@ -78,28 +86,36 @@ pipeclose(struct pipe *p, int writable)
 int
 pipewrite(struct pipe *p, char *addr, int n)
 {
-  int i;
+  char buf[PIPESIZE];
+  int i, j, m;
 
-  acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
-      if(p->readopen == 0 || myproc()->killed){
-        release(&p->lock);
-        return -1;
+  // User memory is copied through buf without holding p->lock:
+  // touching it may fault and sleep to swap the page in.
+  for(i = 0; i < n; i += m){
+    m = n - i < PIPESIZE ? n - i : PIPESIZE;
+    memmove(buf, addr + i, m);
+    acquire(&p->lock);
+    for(j = 0; j < m; j++){
+      while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
+        if(p->readopen == 0 || myproc()->killed){
+          release(&p->lock);
+          return -1;
+        }
+        wakeup(&p->nread);
+        sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
       }
-      wakeup(&p->nread);
-      sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
+      p->data[p->nwrite++ % PIPESIZE] = buf[j];
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+    release(&p->lock);
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
-  release(&p->lock);
   return n;
 }
 
 int
 piperead(struct pipe *p, char *addr, int n)
 {
+  char buf[PIPESIZE];
   int i;
 
   acquire(&p->lock);
@@ -110,12 +126,14 @@ piperead(struct pipe *p, char *addr, int n)
     }
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
+  for(i = 0; i < n && i < PIPESIZE; i++){  //DOC: piperead-copy
     if(p->nread == p->nwrite)
       break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+    buf[i] = p->data[p->nread++ % PIPESIZE];
   }
   wakeup(&p->nwrite);  //DOC: piperead-wakeup
   release(&p->lock);
+  // See pipewrite().
+  memmove(addr, buf, i);
   return i;
 }
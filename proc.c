@@ -4,13 +4,42 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "x86.h"
+#include "traps.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "vmspace.h"
+#include "kstat.h"
+
+// The process table.  struct procs come from a slab cache as they
+// are needed, up to NPROC of them.  Every process is on the list of
+// all processes, oldest first, and on the list of its state, so
+// that the scheduler looks only at RUNNABLE processes and wakeup()
+// only at those sleeping on a channel with the same hash.  UNUSED
+// processes are on no list: they are freed.  All of it is protected
+// by ptable.lock.
+#define NSLEEPQ 64   // hash chains of sleeping processes
 
 struct {
   struct spinlock lock;
-  struct proc proc[NPROC];
-} ptable;
+  struct proc *all;               // all processes
+  struct proc *alltail;
+  struct proc *state[ZOMBIE+1];   // by state; not used for SLEEPING
+  int nstate[ZOMBIE+1];           // processes in each state
+  struct proc *sleepq[NSLEEPQ];   // SLEEPING, by hash of chan
+  int nproc;
+} ptable __attribute__((aligned(CACHELINE)));
+
+static struct kmem_cache *proccache, *vmcache;
+
+// The hot fields of struct proc must share its first cache line.
+_Static_assert(_Alignof(struct proc) == CACHELINE,
+               "struct proc is not cache-line aligned");
+_Static_assert(__builtin_offsetof(struct proc, kstack) + sizeof(char*) <= CACHELINE,
+               "hot fields of struct proc do not fit in a cache line");
+
+// Clock hands of swapvictim() and ksmidle() over ptable.all.
+static struct proc *swaphand, *ksmhand;
 
 static struct proc *initproc;
 
@@ -24,6 +53,8 @@ void
 pinit(void)
 {
   initlock(&ptable.lock, "ptable");
+  proccache = kmem_cache_create("proc", sizeof(struct proc), CACHELINE);
+  vmcache = kmem_cache_create("vmspace", sizeof(struct vmspace), 0);
 }
 
 // Must be called with interrupts disabled
@@ -65,32 +96,157 @@ myproc(void) {
   return p;
 }
 
+// Append p to the state list at *head.  The lists are linked
+// through qnext and qprev and end in 0, but the head's qprev is
+// the tail.
+static void
+qpush(struct proc **head, struct proc *p)
+{
+  p->qnext = 0;
+  if(*head == 0){
+    p->qprev = p;
+    *head = p;
+    return;
+  }
+  p->qprev = (*head)->qprev;
+  p->qprev->qnext = p;
+  (*head)->qprev = p;
+}
+
+static void
+qremove(struct proc **head, struct proc *p)
+{
+  if(p == *head){
+    *head = p->qnext;
+    if(*head)
+      (*head)->qprev = p->qprev;
+  } else {
+    p->qprev->qnext = p->qnext;
+    if(p->qnext)
+      p->qnext->qprev = p->qprev;
+    else
+      (*head)->qprev = p->qprev;
+  }
+  p->qnext = p->qprev = 0;
+}
+
+// The list of processes sleeping on chan.
+static struct proc**
+sleepq(void *chan)
+{
+  return &ptable.sleepq[(((uint)chan * 2654435761U) >> 16) % NSLEEPQ];
+}
+
+// The state list p is on.
+static struct proc**
+stateq(struct proc *p)
+{
+  if(p->state == SLEEPING)
+    return sleepq(p->chan);
+  return &ptable.state[p->state];
+}
+
+// Move p to state s and to the tail of its list.  A process going
+// to sleep must have its chan set first.  Caller holds ptable.lock.
+static void
+setstate(struct proc *p, enum procstate s)
+{
+  if(p->state != UNUSED){
+    qremove(stateq(p), p);
+    ptable.nstate[p->state]--;
+  }
+  p->state = s;
+  if(s != UNUSED){
+    qpush(stateq(p), p);
+    ptable.nstate[s]++;
+  }
+}
+
+// Add p to the list of children at *head (parent->children or
+// parent->zombies).  Caller holds ptable.lock.
+static void
+sibpush(struct proc **head, struct proc *p)
+{
+  p->sibprev = 0;
+  p->sibnext = *head;
+  if(*head)
+    (*head)->sibprev = p;
+  *head = p;
+}
+
+static void
+sibremove(struct proc **head, struct proc *p)
+{
+  if(p->sibprev)
+    p->sibprev->sibnext = p->sibnext;
+  else
+    *head = p->sibnext;
+  if(p->sibnext)
+    p->sibnext->sibprev = p->sibprev;
+  p->sibnext = p->sibprev = 0;
+}
+
+// Free the ZOMBIE p once its parent has collected it.
+// Caller holds ptable.lock.
+static void
+freeproc(struct proc *p)
+{
+  sibremove(&p->parent->zombies, p);
+  kfree_pages(p->kstack, KSTACKORDER);
+  setstate(p, UNUSED);
+  if(p->prev)
+    p->prev->next = p->next;
+  else
+    ptable.all = p->next;
+  if(p->next)
+    p->next->prev = p->prev;
+  else
+    ptable.alltail = p->prev;
+  if(swaphand == p)
+    swaphand = p->next;
+  if(ksmhand == p)
+    ksmhand = p->next;
+  ptable.nproc--;
+  kmem_cache_free(proccache, p);
+}
+
 //PAGEBREAK: 32
-// Look in the process table for an UNUSED proc.
-// If found, change state to EMBRYO and initialize
-// state required to run in the kernel.
-// Otherwise return 0.
+// Allocate a proc, with its kernel stack, and add it to the
+// process table as EMBRYO, with the state required to run in the
+// kernel initialized.  Returns 0 if out of memory or if there are
+// NPROC processes already.
 static struct proc*
 allocproc(void)
 {
   struct proc *p;
-  char *sp;
+  char *sp, *kstack;
 
-  acquire(&ptable.lock);
-
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == UNUSED)
-      goto found;
-
-  release(&ptable.lock);
-  return 0;
+  if((p = kmem_cache_alloc(proccache)) == 0)
+    return 0;
+  if((kstack = kalloc_pages(KSTACKORDER)) == 0){
+    kmem_cache_free(proccache, p);
+    return 0;
+  }
+  memset(p, 0, sizeof(*p));
+  p->kstack = kstack;
 
-found:
-  p->state = EMBRYO;
+  acquire(&ptable.lock);
+  if(ptable.nproc == NPROC){
+    release(&ptable.lock);
+    kfree_pages(kstack, KSTACKORDER);
+    kmem_cache_free(proccache, p);
+    return 0;
+  }
+  ptable.nproc++;
+  p->prev = ptable.alltail;
+  if(ptable.alltail)
+    ptable.alltail->next = p;
+  else
+    ptable.all = p;
+  ptable.alltail = p;
+  setstate(p, EMBRYO);
   p->pid = nextpid++;
-  // acquire(&tickslock);
   p->ctime = ticks;
-  // release(&tickslock);
   p->rtime = 0;
   #if SCHEDULER == SCHED_PBS
   p->priority = 60;
@@ -98,6 +254,13 @@ found:
   p->priority = -1;
   #endif
   p->n_run = 0;
+  p->nfault = 0;
+  p->execns = 0;
+  p->vforked = 0;
+  p->thread = 0;
+  p->multithreaded = 0;
+  p->pgdir = 0;
+  p->vm = 0;
   p->w_time = 0;
   p->tw_time = 0;
   #if SCHEDULER == SCHED_MLFQ
@@ -123,11 +286,6 @@ found:
   //cprintf("%d %d %d\n",p->pid, p->ctime, p->cur_q);
   //#endif
 
-  // Allocate kernel stack.
-  if((p->kstack = kalloc()) == 0){
-    p->state = UNUSED;
-    return 0;
-  }
   sp = p->kstack + KSTACKSIZE;
 
   // Leave room for trap frame.
@@ -153,15 +311,16 @@ void
 userinit(void)
 {
   struct proc *p;
+  pde_t *pgdir;
   extern char _binary_initcode_start[], _binary_initcode_size[];
 
   p = allocproc();
   
   initproc = p;
-  if((p->pgdir = setupkvm()) == 0)
+  if((pgdir = setupkvm()) == 0 || (p->vm = vmsalloc(pgdir, PGSIZE)) == 0)
     panic("userinit: out of memory?");
+  p->pgdir = pgdir;
   inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
-  p->sz = PGSIZE;
   memset(p->tf, 0, sizeof(*p->tf));
   p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
   p->tf->ds = (SEG_UDATA << 3) | DPL_USER;
@@ -173,6 +332,8 @@ userinit(void)
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
+  if((p->fdt = fdtcopy(0)) == 0)
+    panic("userinit: out of memory?");
 
   // this assignment to p->state lets other cores
   // run this process. the acquire forces the above
@@ -180,7 +341,7 @@ userinit(void)
   // because the assignment might not be atomic.
   acquire(&ptable.lock);
 
-  p->state = RUNNABLE;
+  setstate(p, RUNNABLE);
   #if SCHEDULER == SCHED_MLFQ
   //cprintf("%d %d %d \n",p->pid, ticks, p->cur_q);
   push_queue(p->cur_q, p->pid);
@@ -190,75 +351,413 @@ userinit(void)
 }
 
 // Grow current process's memory by n bytes.
-// Return 0 on success, -1 on failure.
+// Growing only moves sz: pages are allocated and zeroed by
+// pagefault() when they are first touched.
+// Return the old size on success, -1 on failure.
 int
 growproc(int n)
 {
-  uint sz;
+  uint sz, oldsz;
+  int locked;
   struct proc *curproc = myproc();
 
-  sz = curproc->sz;
+  // A vfork() child would change its parent's memory size.
+  if(curproc->vforked)
+    return -1;
+  locked = vmbegin();
+  oldsz = sz = curproc->vm->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    if(sz + n < sz || sz + n >= KERNBASE || vmaoverlap(curproc, sz, sz + n)){
+      vmend(locked);
       return -1;
+    }
+    sz += n;
   } else if(n < 0){
-    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    if(sz + n > sz || (sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0){
+      vmend(locked);
       return -1;
+    }
   }
-  curproc->sz = sz;
+  curproc->vm->sz = sz;
+  vmend(locked);
   switchuvm(curproc);
-  return 0;
+  return oldsz;
+}
+
+// Allocate a child of the current process with address space vm
+// and open file table fdt, taking over the caller's references to
+// them.  Registers, cwd and name are the current process's, with
+// %eax cleared so that the system call returns 0 in the child.  The
+// caller finishes setting the child up and lets it run with
+// runchild().  Returns 0 if out of processes, in which case vm and
+// fdt still belong to the caller.
+struct proc*
+newchild(struct vmspace *vm, struct fdtable *fdt)
+{
+  struct proc *np;
+  struct proc *curproc = myproc();
+
+  if((np = allocproc()) == 0)
+    return 0;
+  np->vm = vm;
+  np->pgdir = vm->pgdir;
+  acquire(&ptable.lock);
+  np->parent = curproc;
+  sibpush(&curproc->children, np);
+  release(&ptable.lock);
+  *np->tf = *curproc->tf;
+  np->tf->eax = 0;
+  np->fdt = fdt;
+  np->cwd = idup(curproc->cwd);
+  safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+  return np;
+}
+
+// Make the child set up by newchild() runnable.  Returns its pid.
+int
+runchild(struct proc *np)
+{
+  int pid;
+
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+
+  setstate(np, RUNNABLE);
+  #if SCHEDULER == SCHED_MLFQ
+  //cprintf("%d %d %d \n",np->pid, ticks, np->cur_q);
+  push_queue(np->cur_q, np->pid);
+  #endif
+
+  release(&ptable.lock);
+
+  return pid;
 }
 
 // Create a new process copying p as the parent.
 // Sets up stack to return as if from system call.
-// Caller must set state of returned proc to RUNNABLE.
 int
 fork(void)
 {
-  int i, pid;
+  int i, locked;
+  pde_t *pgdir;
+  struct vmspace *vm;
+  struct fdtable *fdt;
   struct proc *np;
   struct proc *curproc = myproc();
 
-  // Allocate process.
-  if((np = allocproc()) == 0){
+  if((fdt = fdtcopy(curproc->fdt)) == 0)
+    return -1;
+  locked = vmbegin();
+  if((pgdir = copyuvm(curproc->pgdir, curproc->vm->sz)) == 0){
+    vmend(locked);
+    fdtrelease(fdt);
+    return -1;
+  }
+  if((vm = vmsalloc(pgdir, curproc->vm->sz)) == 0){
+    vmend(locked);
+    freevm(pgdir);
+    fdtrelease(fdt);
+    return -1;
+  }
+  if((np = newchild(vm, fdt)) == 0){
+    vmend(locked);
+    vmsrelease(vm);
+    fdtrelease(fdt);
     return -1;
   }
+  for(i = 0; i < NVMA; i++){
+    vm->vma[i] = curproc->vm->vma[i];
+    vmadup(&vm->vma[i]);
+  }
+  vmend(locked);
+  // copyuvm() made the writable pages read-only.
+  tlbshootdown();
+  return runchild(np);
+}
+
+// Create a child that runs in the current process's address space,
+// without copying it, until it calls exec() or exit(); the parent
+// sleeps until then.  The child must not return from the function
+// that called vfork() or change the memory size.
+int
+vfork(void)
+{
+  int pid;
+  struct fdtable *fdt;
+  struct proc *np;
+  struct proc *curproc = myproc();
 
-  // Copy process state from proc.
-  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
-    kfree(np->kstack);
-    np->kstack = 0;
-    np->state = UNUSED;
+  if((fdt = fdtcopy(curproc->fdt)) == 0)
+    return -1;
+  if((np = newchild(vmsdup(curproc->vm), fdt)) == 0){
+    vmsrelease(curproc->vm);
+    fdtrelease(fdt);
     return -1;
   }
-  np->sz = curproc->sz;
-  np->parent = curproc;
-  *np->tf = *curproc->tf;
+  np->vforked = 1;
+  np->multithreaded = curproc->multithreaded;
+  pid = runchild(np);
+  acquire(&ptable.lock);
+  while(np->vforked)
+    sleep(np, &ptable.lock);
+  release(&ptable.lock);
+  return pid;
+}
 
-  // Clear %eax so that fork returns 0 in the child.
-  np->tf->eax = 0;
+// The vfork() child p has its own address space now (exec):
+// let the parent continue.
+void
+vforkdone(struct proc *p)
+{
+  acquire(&ptable.lock);
+  p->vforked = 0;
+  wakeup1(p);
+  release(&ptable.lock);
+}
 
-  for(i = 0; i < NOFILE; i++)
-    if(curproc->ofile[i])
-      np->ofile[i] = filedup(curproc->ofile[i]);
-  np->cwd = idup(curproc->cwd);
+// Create a thread: a child that shares the current process's
+// memory and open files, and starts at fn(arg) on the PGSIZE-byte
+// user stack at stack.  fn must not return; it calls exit(), and
+// the creator collects it with join().  Returns the thread's pid.
+int
+clone(uint fn, uint arg, uint stack)
+{
+  uint sp;
+  struct proc *np;
+  struct proc *curproc = myproc();
 
-  safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+  if(curproc->vforked)
+    return -1;
+  sp = stack + PGSIZE - 2*sizeof(uint);
+  ((uint*)sp)[0] = 0xffffffff;  // fake return PC
+  ((uint*)sp)[1] = arg;
+
+  curproc->multithreaded = 1;
+  if((np = newchild(vmsdup(curproc->vm), fdtdup(curproc->fdt))) == 0){
+    vmsrelease(curproc->vm);
+    fdtrelease(curproc->fdt);
+    return -1;
+  }
+  np->thread = 1;
+  np->multithreaded = 1;
+  np->ustack = stack;
+  np->tf->eip = fn;
+  np->tf->esp = sp;
+  return runchild(np);
+}
 
-  pid = np->pid;
+// An exited child of curproc to collect: a thread made by clone()
+// if thread is set, otherwise a process.  Returns 0 if none has
+// exited, and sets *havekids if curproc has any such children at
+// all.  Caller holds ptable.lock.
+static struct proc*
+zombiechild(struct proc *curproc, int thread, int *havekids)
+{
+  struct proc *p;
+
+  *havekids = 1;
+  for(p = curproc->zombies; p; p = p->sibnext)
+    if(p->thread == thread)
+      return p;
+  for(p = curproc->children; p; p = p->sibnext)
+    if(p->thread == thread)
+      return 0;
+  *havekids = 0;
+  return 0;
+}
+
+// Wait for a thread made by clone() to exit and return its pid,
+// with its user stack in *stack.  Return -1 if this process has
+// no threads.
+int
+join(uint *stack)
+{
+  struct proc *p;
+  int havekids, pid;
+  struct proc *curproc = myproc();
 
   acquire(&ptable.lock);
+  for(;;){
+    if((p = zombiechild(curproc, 1, &havekids)) != 0){
+      pid = p->pid;
+      *stack = p->ustack;
+      freeproc(p);
+      release(&ptable.lock);
+      return pid;
+    }
+    if(!havekids || curproc->killed){
+      release(&ptable.lock);
+      return -1;
+    }
+    sleep(curproc, &ptable.lock);
+  }
+}
 
-  np->state = RUNNABLE;
-  #if SCHEDULER == SCHED_MLFQ
-  //cprintf("%d %d %d \n",np->pid, ticks, np->cur_q);
-  push_queue(np->cur_q, np->pid);
-  #endif
+// Allocate an address space with page table pgdir of sz bytes and
+// no vmas, holding one reference.  Returns 0 if out of memory.
+struct vmspace*
+vmsalloc(pde_t *pgdir, uint sz)
+{
+  struct vmspace *vm;
+
+  if((vm = kmem_cache_alloc(vmcache)) == 0)
+    return 0;
+  initsleeplock(&vm->lock, "vm");
+  vm->ref = 1;
+  vm->pgdir = pgdir;
+  vm->sz = sz;
+  memset(vm->vma, 0, sizeof(vm->vma));
+  return vm;
+}
+
+// Take another reference to vm (clone, vfork).
+struct vmspace*
+vmsdup(struct vmspace *vm)
+{
+  __sync_fetch_and_add(&vm->ref, 1);
+  return vm;
+}
+
+// Drop a reference to vm.  The last one unmaps everything mapped,
+// writing back shared file pages, and frees the page table.
+void
+vmsrelease(struct vmspace *vm)
+{
+  int i;
+
+  if(__sync_sub_and_fetch(&vm->ref, 1) > 0)
+    return;
+  for(i = 0; i < NVMA; i++){
+    vmaunmap(vm->pgdir, &vm->vma[i]);
+    vmaclose(&vm->vma[i]);
+  }
+  freevm(vm->pgdir);
+  kmem_cache_free(vmcache, vm);
+}
+
+// Does the current process share its address space, with threads
+// or with a vfork() parent or child?
+static int
+vmshared(struct proc *p)
+{
+  return p->multithreaded || p->vforked;
+}
+
+// Begin a change to the current process's sz or vmas.  In an
+// address space shared by threads the changes are serialized by
+// the address space's lock; a process with an address space of its
+// own takes no lock.  Returns the argument for vmend().
+int
+vmbegin(void)
+{
+  struct proc *curproc = myproc();
+
+  if(!vmshared(curproc))
+    return 0;
+  acquiresleep(&curproc->vm->lock);
+  return 1;
+}
+
+void
+vmend(int locked)
+{
+  if(locked)
+    releasesleep(&myproc()->vm->lock);
+}
+
+// Move the current process to address space vm (exec), or to none
+// (vm 0, exit).  Returns the old one, for the caller to release
+// with vmsrelease() once it no longer runs on it.
+struct vmspace*
+vmswitch(struct vmspace *vm)
+{
+  struct vmspace *old;
+  struct proc *curproc = myproc();
 
+  acquire(&ptable.lock);
+  old = curproc->vm;
+  curproc->vm = vm;
+  curproc->pgdir = vm ? vm->pgdir : 0;
+  curproc->multithreaded = 0;
+  if(vm == 0)
+    switchkvm();
   release(&ptable.lock);
+  return old;
+}
 
-  return pid;
+// Copy the current process's vma containing va into *v, with
+// references of its own, which the caller drops with vmaclose().
+// Another thread may unmap the original meanwhile.  Returns 0 if
+// no vma contains va.
+int
+vmacopy(uint va, struct vma *v)
+{
+  struct vmspace *vm = myproc()->vm;
+  struct vma *w;
+  int found;
+
+  found = 0;
+  acquiresleep(&vm->lock);
+  for(w = vm->vma; w < &vm->vma[NVMA]; w++){
+    if(w->type != VMA_NONE && va >= w->start && va < w->end){
+      *v = *w;
+      vmadup(v);
+      found = 1;
+      break;
+    }
+  }
+  releasesleep(&vm->lock);
+  return found;
+}
+
+// Flush the current process's TLB entries on the other CPUs that
+// are running threads of it, after a PTE was changed or removed.
+// A CPU that switches to the address space later loads %cr3, which
+// flushes it.  The caller flushes its own TLB.  Must not be called
+// holding a spinlock: the CPUs being waited for may be spinning for
+// it with interrupts off.
+void
+tlbshootdown(void)
+{
+  struct proc *curproc = myproc();
+  struct cpu *c;
+  int n;
+
+  if(!curproc->multithreaded)
+    return;
+  n = 0;
+  acquire(&ptable.lock);
+  for(c = cpus; c < &cpus[ncpu]; c++){
+    if(c != mycpu() && c->proc && c->proc->pgdir == curproc->pgdir){
+      c->tlbflush = 1;
+      n++;
+    }
+  }
+  release(&ptable.lock);
+  if(n == 0)
+    return;
+  lapicipi(T_TLBFLUSH);
+  for(c = cpus; c < &cpus[ncpu]; c++){
+    while(c->tlbflush){
+      // Another CPU may be waiting for this one.
+      pushcli();
+      tlbintr();
+      popcli();
+    }
+  }
+}
+
+// TLB shootdown interrupt, or a CPU waiting in tlbshootdown().
+void
+tlbintr(void)
+{
+  struct cpu *c = mycpu();
+
+  if(c->tlbflush){
+    lcr3(rcr3());
+    c->tlbflush = 0;
+  }
 }
 
 // Exit the current process.  Does not return.
@@ -269,21 +768,17 @@ exit(void)
 {
   struct proc *curproc = myproc();
   struct proc *p;
-  int fd;
 
   if(curproc == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(fd = 0; fd < NOFILE; fd++){
-    if(curproc->ofile[fd]){
-      fileclose(curproc->ofile[fd]);
-      curproc->ofile[fd] = 0;
-    }
-  }
-  //acquire(&tickslock);
+  // Close all open files, unless threads still use them.
+  fdtrelease(curproc->fdt);
+  curproc->fdt = 0;
   curproc->etime = ticks;
-  // release(&tickslock);
+
+  // Leave the address space, freeing it if this was its last user.
+  vmsrelease(vmswitch(0));
 
   begin_op();
   iput(curproc->cwd);
@@ -292,28 +787,44 @@ exit(void)
 
   acquire(&ptable.lock);
 
+  // A vfork() child gives the address space back to its parent.
+  if(curproc->vforked){
+    curproc->vforked = 0;
+    wakeup1(curproc);
+  }
+
   // Parent might be sleeping in wait().
   wakeup1(curproc->parent);
 
   // Pass abandoned children to init.
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->parent == curproc){
-      p->parent = initproc;
-      if(p->state == ZOMBIE)
-        wakeup1(initproc);
-    }
+  while((p = curproc->children) != 0){
+    sibremove(&curproc->children, p);
+    p->parent = initproc;
+    p->thread = 0;
+    sibpush(&initproc->children, p);
+  }
+  if(curproc->zombies)
+    wakeup1(initproc);
+  while((p = curproc->zombies) != 0){
+    sibremove(&curproc->zombies, p);
+    p->parent = initproc;
+    p->thread = 0;
+    sibpush(&initproc->zombies, p);
   }
   //#ifdef GRAPH
   //cprintf("%d %d %d\n",curproc->pid, curproc->etime, curproc->cur_q);
   //#endif
   // Jump into the scheduler, never to return.
-  curproc->state = ZOMBIE;
+  sibremove(&curproc->parent->children, curproc);
+  sibpush(&curproc->parent->zombies, curproc);
+  setstate(curproc, ZOMBIE);
   sched();
   panic("zombie exit");
 }
 
 // Wait for a child process to exit and return its pid.
-// Return -1 if this process has no children.
+// Return -1 if this process has no children.  Threads are
+// collected with join() instead.
 int
 wait(void)
 {
@@ -323,26 +834,12 @@ wait(void)
   
   acquire(&ptable.lock);
   for(;;){
-    // Scan through table looking for exited children.
-    havekids = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != curproc)
-        continue;
-      havekids = 1;
-      if(p->state == ZOMBIE){
-        // Found one.
-        pid = p->pid;
-        kfree(p->kstack);
-        p->kstack = 0;
-        freevm(p->pgdir);
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->state = UNUSED;
-        release(&ptable.lock);
-        return pid;
-      }
+    // Look for an exited child.
+    if((p = zombiechild(curproc, 0, &havekids)) != 0){
+      pid = p->pid;
+      freeproc(p);
+      release(&ptable.lock);
+      return pid;
     }
 
     // No point waiting if we don't have any children.
@@ -371,32 +868,51 @@ scheduler(void)
   c->proc = 0;
   #if SCHEDULER == SCHED_RR
   struct proc *p;
+  int n, ran;
   for(;;){
     // Enable interrupts on this processor.
     sti();
 
-    // Loop over process table looking for process to run.
+    // One pass: run as many processes from the head of the RUNNABLE
+    // list as were runnable when it started.  A process that
+    // becomes runnable again goes to the tail.
+    ran = 0;
     acquire(&ptable.lock);
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE)
-        continue;
+    for(n = ptable.nstate[RUNNABLE]; n > 0; n--){
+      if((p = ptable.state[RUNNABLE]) == 0)
+        break;
+      ran = 1;
 
       // Switch to chosen process.  It is the process's job
       // to release ptable.lock and then reacquire it
       // before jumping back to us.
       c->proc = p;
       switchuvm(p);
-      p->state = RUNNING;
+      setstate(p, RUNNING);
       p->w_time = 0;
       p->n_run ++;
       swtch(&(c->scheduler), p->context);
-      switchkvm();
 
       // Process is done running for now.
       // It should have changed its p->state before coming back.
+      // Stay on its page table: the next process's switchuvm()
+      // replaces it, and no page table can be freed while we
+      // hold ptable.lock.
       c->proc = 0;
     }
+    // Leave the last process's page table before letting go of
+    // ptable.lock; once that process exits and is reaped, its
+    // page directory is freed.
+    if(ran)
+      switchkvm();
     release(&ptable.lock);
+
+    // Nothing to run: use the time to zero a free page and to
+    // look for pages to merge.
+    if(!ran){
+      kzeroidle();
+      ksmidle();
+    }
   }
 
   #elif SCHEDULER == SCHED_FCFS
@@ -411,10 +927,7 @@ scheduler(void)
 
     // Loop over process table looking for process to run.
     acquire(&ptable.lock);
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE)
-        continue;
-
+    for(p = ptable.state[RUNNABLE]; p; p = p->qnext){
       // Search for minimum creation time
       if(create_time > p->ctime)
       {
@@ -428,7 +941,7 @@ scheduler(void)
       //cprintf("Process with pid %d running on CPU %d\n",selected->pid,c->apicid);
       c->proc = selected;
       switchuvm(selected);
-      selected->state = RUNNING;
+      setstate(selected, RUNNING);
       selected->w_time = 0;
       selected->n_run ++;
       swtch(&(c->scheduler), selected->context);
@@ -436,6 +949,13 @@ scheduler(void)
     }
     c->proc = 0;
     release(&ptable.lock);
+
+    // Nothing to run: use the time to zero a free page and to
+    // look for pages to merge.
+    if(selected == 0){
+      kzeroidle();
+      ksmidle();
+    }
   }
 
   #elif SCHEDULER == SCHED_PBS
@@ -451,10 +971,7 @@ scheduler(void)
 
     // Loop over process table looking for process to run.
     acquire(&ptable.lock);
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE)
-        continue;
-
+    for(p = ptable.state[RUNNABLE]; p; p = p->qnext){
       // Search for minimum priority
       if(priority > p->priority)
       {
@@ -478,7 +995,7 @@ scheduler(void)
       //cprintf("Process with pid %d and priority %d running on CPU %d\n",selected->pid,selected->priority,c->apicid);
       c->proc = selected;
       switchuvm(selected);
-      selected->state = RUNNING;
+      setstate(selected, RUNNING);
       selected->w_time = 0;
       selected->n_run ++;
       swtch(&(c->scheduler), selected->context);
@@ -486,6 +1003,13 @@ scheduler(void)
     }
     c->proc = 0;
     release(&ptable.lock);
+
+    // Nothing to run: use the time to zero a free page and to
+    // look for pages to merge.
+    if(selected == 0){
+      kzeroidle();
+      ksmidle();
+    }
   }
   
   #elif SCHEDULER == SCHED_MLFQ
@@ -510,22 +1034,24 @@ scheduler(void)
     if(selected_pid == -1)
     {
       release(&ptable.lock);
+      kzeroidle();
+      ksmidle();
       continue;
     }
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    for(p = ptable.state[RUNNABLE]; p; p = p->qnext){
       if(p->pid == selected_pid)
       {
         selected = p;
         break;
       }
     }
-    pop_queue(selected->cur_q);
+    pop_queue(i);
     if(selected != 0)
     {
       //cprintf("Selected process with pid %d in queue %d\n",selected->pid,selected->cur_q);
       c->proc = selected;
       switchuvm(selected);
-      selected->state = RUNNING;
+      setstate(selected, RUNNING);
       selected->n_ticks = 0;
       selected->w_time = 0;
       selected->n_run ++;
@@ -562,6 +1088,7 @@ sched(void)
   if(readeflags()&FL_IF)
     panic("sched interruptible");
   intena = mycpu()->intena;
+  kstatinc(KSTAT_SWTCH);
   swtch(&p->context, mycpu()->scheduler);
   mycpu()->intena = intena;
 }
@@ -571,7 +1098,7 @@ void
 yield(void)
 {
   acquire(&ptable.lock);  //DOC: yieldlock
-  myproc()->state = RUNNABLE;
+  setstate(myproc(), RUNNABLE);
   #if SCHEDULER == SCHED_MLFQ
     push_queue(myproc()->cur_q, myproc()->pid);
   #endif
@@ -595,6 +1122,7 @@ forkret(void)
     first = 0;
     iinit(ROOTDEV);
     initlog(ROOTDEV);
+    swapinit(ROOTDEV);
   }
 
   // Return to "caller", actually trapret (see allocproc).
@@ -625,7 +1153,7 @@ sleep(void *chan, struct spinlock *lk)
   }
   // Go to sleep.
   p->chan = chan;
-  p->state = SLEEPING;
+  setstate(p, SLEEPING);
 
   sched();
 
@@ -645,17 +1173,19 @@ sleep(void *chan, struct spinlock *lk)
 static void
 wakeup1(void *chan)
 {
-  struct proc *p;
+  struct proc *p, *next;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan)
+  for(p = *sleepq(chan); p; p = next){
+    next = p->qnext;
+    if(p->chan == chan)
     {
-      p->state = RUNNABLE;
+      setstate(p, RUNNABLE);
       #if SCHEDULER == SCHED_MLFQ
         push_queue(p->cur_q, p->pid);
         //cprintf("%d %d %d \n",p->pid, ticks, p->cur_q);
       #endif
     }
+  }
 }
 
 // Wake up all processes sleeping on chan.
@@ -667,6 +1197,45 @@ wakeup(void *chan)
   release(&ptable.lock);
 }
 
+// Sleep until n clock ticks have passed.  ticks is written without
+// a lock (clock.c), but update_times() wakes the processes sleeping
+// on it under ptable.lock after every tick, so checking it under
+// ptable.lock cannot miss a wakeup.  Returns -1 if the process is
+// killed meanwhile.
+int
+sleepticks(uint n)
+{
+  uint ticks0;
+
+  acquire(&ptable.lock);
+  ticks0 = ticks;
+  while(ticks - ticks0 < n){
+    if(myproc()->killed){
+      release(&ptable.lock);
+      return -1;
+    }
+    sleep(&ticks, &ptable.lock);
+  }
+  release(&ptable.lock);
+  return 0;
+}
+
+// Mark p killed.  Caller holds ptable.lock.
+static void
+killproc(struct proc *p)
+{
+  p->killed = 1;
+  // Wake process from sleep if necessary.
+  if(p->state == SLEEPING)
+  {
+    setstate(p, RUNNABLE);
+    #if SCHEDULER == SCHED_MLFQ
+    push_queue(p->cur_q, p->pid);
+    cprintf("%d %d %d \n",p->pid, ticks, p->cur_q);
+    #endif
+  }
+}
+
 // Kill the process with the given pid.
 // Process won't exit until it returns
 // to user space (see trap in trap.c).
@@ -676,18 +1245,9 @@ kill(int pid)
   struct proc *p;
 
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = ptable.all; p; p = p->next){
     if(p->pid == pid){
-      p->killed = 1;
-      // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-      {
-        p->state = RUNNABLE;
-        #if SCHEDULER == SCHED_MLFQ
-        push_queue(p->cur_q, p->pid);
-        cprintf("%d %d %d \n",p->pid, ticks, p->cur_q);
-        #endif
-      }
+      killproc(p);
       release(&ptable.lock);
       return 0;
     }
@@ -696,7 +1256,153 @@ kill(int pid)
   return -1;
 }
 
+// The OOM killer (see reclaim.c).  Kill the process whose death
+// frees the most memory: the one with the most resident pages,
+// weighted by priority under PBS so that, of two equally large
+// processes, the one with the larger priority number goes first.
+// Its threads share its memory and die with it.  Init is never
+// chosen.  While an earlier victim is still exiting, no one else is
+// killed.  Returns the pid of the victim, or -1 if there is none.
+static int oompid;
+
+int
+oomkill(void)
+{
+  struct proc *p, *victim;
+  uint score, best, rss;
+
+  acquire(&ptable.lock);
+  for(p = ptable.all; oompid && p; p = p->next){
+    if(p->pid == oompid && p->state != ZOMBIE){
+      release(&ptable.lock);
+      return oompid;
+    }
+  }
+  victim = 0;
+  best = 0;
+  for(p = ptable.all; p; p = p->next){
+    if(p->state == EMBRYO || p->state == ZOMBIE ||
+       p == initproc || p->killed || p->pgdir == 0)
+      continue;
+    rss = uvmresident(p->pgdir, p->vm->sz);
+    score = rss * (p->priority <= 100 ? 100 + p->priority : 100);
+    if(score > best){
+      best = score;
+      victim = p;
+    }
+  }
+  if(victim == 0){
+    oompid = 0;
+    release(&ptable.lock);
+    return -1;
+  }
+  oompid = victim->pid;
+  cprintf("oom: killing pid %d %s, %d pages resident\n",
+          victim->pid, victim->name, uvmresident(victim->pgdir, victim->vm->sz));
+  for(p = ptable.all; p; p = p->next)
+    if(p == victim || (p->pgdir == victim->pgdir && p->state != ZOMBIE))
+      killproc(p);
+  release(&ptable.lock);
+  kstatinc(KSTAT_OOMKILL);
+  return oompid;
+}
+
 //PAGEBREAK: 36
+// Is pgdir in use on another CPU (by another process running on
+// the same address space)?  That CPU might hold any of its PTEs in
+// its TLB.  A process that is not running has its TLB entries
+// flushed when it is switched back in.  Caller holds ptable.lock.
+static int
+pgdirbusy(pde_t *pgdir)
+{
+  struct proc *p;
+
+  for(p = ptable.state[RUNNING]; p; p = p->qnext)
+    if(p->pgdir == pgdir && p != myproc())
+      return 1;
+  return 0;
+}
+
+// Pick a user page to swap out into slot: run the clock hand over
+// the page tables of all processes (see clockscan()) and replace
+// the PTE of the page it stops at with a PTE_SWAP entry for slot.
+// Page tables in use on another CPU are skipped (pgdirbusy()).
+// Returns the page, which the caller writes out and frees, or 0
+// if there is nothing to evict.
+char*
+swapvictim(uint slot)
+{
+  static uint va;
+  struct proc *p;
+  pte_t *pte;
+  char *page;
+  int n;
+
+  acquire(&ptable.lock);
+  for(n = 0; n <= 2*ptable.nproc; n++){
+    if(swaphand == 0){
+      swaphand = ptable.all;
+      va = 0;
+    }
+    p = swaphand;
+    if((p->state == RUNNABLE || p->state == SLEEPING || p->state == RUNNING) &&
+       p->pgdir && !pgdirbusy(p->pgdir) &&
+       (pte = clockscan(p->pgdir, &va)) != 0){
+      page = P2V(PTE_ADDR(*pte));
+      *pte = (slot * PGSIZE) | (PTE_FLAGS(*pte) & ~PTE_P) | PTE_SWAP;
+      if(myproc() && p->pgdir == myproc()->pgdir)
+        invlpg((void*)va);
+      va += PGSIZE;
+      release(&ptable.lock);
+      return page;
+    }
+    swaphand = p->next;
+    va = 0;
+  }
+  release(&ptable.lock);
+  return 0;
+}
+
+// Let the same-page merger (ksm.c) scan the next KSMBATCH pages,
+// at most once per clock tick.  The hand moves over the processes
+// that are not running; threads are skipped, since their memory is
+// the process's.  Called by the scheduler when it is idle.
+void
+ksmidle(void)
+{
+  static uint va, lastscan;
+  struct proc *p;
+  int n, scanned;
+
+  if(ticks == lastscan)
+    return;
+  acquire(&ptable.lock);
+  if(ticks == lastscan){
+    release(&ptable.lock);
+    return;
+  }
+  lastscan = ticks;
+  for(n = 0; n < ptable.nproc; n++){
+    if(ksmhand == 0){
+      ksmhand = ptable.all;
+      va = 0;
+    }
+    p = ksmhand;
+    scanned = 0;
+    if((p->state == RUNNABLE || p->state == SLEEPING) && !p->thread &&
+       p->pgdir && !pgdirbusy(p->pgdir)){
+      if(ksmscan(p->pgdir, &va, KSMBATCH))
+        break;  // more of this process next time
+      scanned = 1;
+    }
+    va = 0;
+    ksmhand = p->next;
+    if(scanned)
+      break;
+  }
+  release(&ptable.lock);
+}
+
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
 // No lock to avoid wedging a stuck machine further.
@@ -716,9 +1422,7 @@ procdump(void)
   char *state;
   uint pc[10];
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->state == UNUSED)
-      continue;
+  for(p = ptable.all; p; p = p->next){
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
       state = states[p->state];
     else
@@ -740,33 +1444,22 @@ int
 waitx(int* wtime, int* rtime)
 {
   struct proc *p;
-  int havekids, pid;
+  int havekids, pid, rt, wt;
   struct proc *curproc = myproc();
   
   acquire(&ptable.lock);
   for(;;){
-    // Scan through table looking for exited children.
-    havekids = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != curproc)
-        continue;
-      havekids = 1;
-      if(p->state == ZOMBIE){
-        // Found one.
-        pid = p->pid;
-        kfree(p->kstack);
-        p->kstack = 0;
-        freevm(p->pgdir);
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->state = UNUSED;
-        *rtime = p->rtime;
-        *wtime = p->tw_time;
-        release(&ptable.lock);
-        return pid;
-      }
+    // Look for an exited child.
+    if((p = zombiechild(curproc, 0, &havekids)) != 0){
+      pid = p->pid;
+      rt = p->rtime;
+      wt = p->tw_time;
+      freeproc(p);
+      release(&ptable.lock);
+      // Not under ptable.lock: storing to user memory may fault.
+      *rtime = rt;
+      *wtime = wt;
+      return pid;
     }
 
     // No point waiting if we don't have any children.
@@ -782,41 +1475,41 @@ waitx(int* wtime, int* rtime)
 
 // Increment the runtime of all RUNNING processes
 // Increment the waittime of all RUNNABLE processes
+// Wake up processes in sleep() waiting for the next tick
+// (done here so the timer takes ptable.lock only once per tick)
 void 
 update_times()
 {
   struct proc* p;
   acquire(&ptable.lock);
-  for(p=ptable.proc;p < &ptable.proc[NPROC];p++)
+  for(p=ptable.state[RUNNING]; p; p=p->qnext)
   {
-    if(p->state == RUNNING)
-    {
-      p->rtime ++;
-      #if SCHEDULER == SCHED_MLFQ
-      p->q[p->cur_q]++;
-      p->n_ticks++;
-      #endif 
-    }
-    if(p->state == RUNNABLE)
+    p->rtime ++;
+    #if SCHEDULER == SCHED_MLFQ
+    p->q[p->cur_q]++;
+    p->n_ticks++;
+    #endif 
+  }
+  for(p=ptable.state[RUNNABLE]; p; p=p->qnext)
+  {
+    p->tw_time++;
+    p->w_time++;
+    #if SCHEDULER == SCHED_MLFQ
+    //cprintf("%d %d\n",p->w_time, queues_aging[p->cur_q]);
+    if(p->w_time > queues_aging[p->cur_q] && p->cur_q != 0)
     {
-      p->tw_time++;
-      p->w_time++;
-      #if SCHEDULER == SCHED_MLFQ
-      //cprintf("%d %d\n",p->w_time, queues_aging[p->cur_q]);
-      if(p->w_time > queues_aging[p->cur_q] && p->cur_q != 0)
-      {
-        pop_pid_queue(p->cur_q, p->pid);
-        p->cur_q --;
-        //#ifdef GRAPH
-        //cprintf("%d %d %d\n",p->pid, ticks, p->cur_q);
-        //#endif
-        push_queue(p->cur_q,p->pid);
-        p->w_time = 0;
-        //cprintf("Process %d went to queue %d due to aging \n",p->pid, p->cur_q);
-      }
-      #endif
+      pop_pid_queue(p->cur_q, p->pid);
+      p->cur_q --;
+      //#ifdef GRAPH
+      //cprintf("%d %d %d\n",p->pid, ticks, p->cur_q);
+      //#endif
+      push_queue(p->cur_q,p->pid);
+      p->w_time = 0;
+      //cprintf("Process %d went to queue %d due to aging \n",p->pid, p->cur_q);
     }
+    #endif
   }
+  wakeup1(&ticks);
   release(&ptable.lock);
 }
 
@@ -826,8 +1519,9 @@ set_priority (int new_priority, int pid)
 {
   struct proc* p;
   int old_priority = 101;
-  // acquire(&ptable.lock);
-  for(p=ptable.proc; p < &ptable.proc[NPROC];p++)
+  // The list changes as processes are freed: walk it locked.
+  acquire(&ptable.lock);
+  for(p=ptable.all; p; p=p->next)
   {
     if(p->pid == pid)
     {
@@ -836,13 +1530,12 @@ set_priority (int new_priority, int pid)
       break;
     }
   }
+  release(&ptable.lock);
   if(old_priority == 101)
   {
     cprintf("No process with pid %d \n",pid);
-    // release(&ptable.lock);
     return -1;
   }
-  //release(&ptable.lock);
   if(old_priority > new_priority) // If priority increases, reschedule
   {
     yield();
@@ -952,7 +1645,7 @@ void
 proc_info ()
 {
   struct proc* p;
-  cprintf(" PID  Priority  State    r_time w_time n_run  cur_q   q0   q1   q2   q3   q4 \n\n");
+  cprintf(" PID  Priority  State    r_time w_time n_run  cur_q   q0   q1   q2   q3   q4   rss  faults\n\n");
   static char *states[] = {
     [UNUSED]    "unused  ",
     [EMBRYO]    "embryo  ",
@@ -961,11 +1654,13 @@ proc_info ()
     [RUNNING]   "running ",
     [ZOMBIE]    "zombie  "
   };
-  for(p=ptable.proc; p != &ptable.proc[NPROC]; p++)
+  acquire(&ptable.lock);
+  for(p=ptable.all; p; p=p->next)
   {
-    if(p->state == UNUSED) continue;
-    cprintf(" %d    %d        %s    %d      %d      %d     %d    %d    %d    %d    %d   %d\n",
-      p->pid, p->priority, states[p->state], p->rtime, p->w_time, p->n_run, p->cur_q, p->q[0], p->q[1], p->q[2], p->q[3], p->q[4] );
+    cprintf(" %d    %d        %s    %d      %d      %d     %d    %d    %d    %d    %d   %d    %d    %d\n",
+      p->pid, p->priority, states[p->state], p->rtime, p->w_time, p->n_run, p->cur_q, p->q[0], p->q[1], p->q[2], p->q[3], p->q[4],
+      p->pgdir ? uvmresident(p->pgdir, p->vm->sz) : 0, p->nfault);
   }
+  release(&ptable.lock);
   return;
 }
\ No newline at end of file
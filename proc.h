@@ -1,14 +1,17 @@
-// Per-CPU state
+// Per-CPU state.  The fields used on every context switch come
+// first, and each struct cpu starts a cache line of its own so
+// that CPUs do not write to each other's lines.
 struct cpu {
-  uchar apicid;                // Local APIC ID
+  struct proc *proc;           // The process running on this cpu or null
   struct context *scheduler;   // swtch() here to enter scheduler
-  struct taskstate ts;         // Used by x86 to find stack for interrupt
-  struct segdesc gdt[NSEGS];   // x86 global descriptor table
-  volatile uint started;       // Has the CPU started?
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
-  struct proc *proc;           // The process running on this cpu or null
-};
+  uchar apicid;                // Local APIC ID
+  volatile uint started;       // Has the CPU started?
+  volatile int tlbflush;       // Asked to flush its TLB (tlbshootdown)
+  struct taskstate ts;         // Used by x86 to find stack for interrupt
+  struct segdesc gdt[NSEGS];   // x86 global descriptor table
+} __attribute__((aligned(CACHELINE)));
 
 extern struct cpu cpus[NCPU];
 extern int ncpu;
@@ -34,32 +37,77 @@ struct context {
 
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
-// Per-process state
+// A mapped range of user memory.  File pages are read in by
+// pagefault() on first access; exec() makes one file vma per ELF
+// segment, and mmap() one per mapping above the heap.  Shared
+// memory segments are mapped whole by shm_open(), also above the
+// heap.
+enum vmatype { VMA_NONE, VMA_FILE, VMA_SHM };
+
+struct vma {
+  enum vmatype type;           // VMA_NONE if the slot is free
+  uint start;                  // First address (page aligned)
+  uint end;                    // One past the last address
+  struct inode *ip;            // VMA_FILE: backing file
+  uint off;                    // VMA_FILE: file offset of start
+  uint filesz;                 // VMA_FILE: bytes backed by the file; the rest is zero-filled
+  int shmid;                   // VMA_SHM: segment
+  int writable;                // Pages may be mapped writable
+  int shared;                  // VMA_FILE: MAP_SHARED, pages come from the file page cache
+  int text;                    // VMA_FILE: program segment mapped by exec(), counted in ip->ntext
+};
+
+// Per-process state.  The fields the scheduler, sleep()/wakeup()
+// and the timer (update_times()) touch on every pass are kept
+// together in the first cache line (struct procs are cache-line
+// aligned, see pinit(), and proc.c checks that they fit).  The one
+// exception is q[], which only MLFQ counts in and which does not
+// fit; it starts the second line.  The rest is used by system calls
+// of the process itself.
 struct proc {
-  uint sz;                     // Size of process memory (bytes)
-  pde_t* pgdir;                // Page table
-  char *kstack;                // Bottom of kernel stack for this process
+  // Hot: one cache line.
   enum procstate state;        // Process state
-  int pid;                     // Process ID
-  struct proc *parent;         // Parent process
-  struct trapframe *tf;        // Trap frame for current syscall
-  struct context *context;     // swtch() here to run process
+  struct proc *qnext;          // List of the processes in this state (setstate())
+  struct proc *qprev;
   void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
-  struct file *ofile[NOFILE];  // Open files
+  int pid;                     // Process ID
+  uint priority;               // Priority of the task (Applicable for PBS)
+  uint cur_q;                  // Current queue of the process (Applicable for MLFQ)
+  uint w_time;                 // Number of ticks the process has been waiting for (Reset to 0 everytime it gets CPU)
+  uint n_ticks;                // Number of ticks the process has executed for (reset everytime it changes queue or gets CPU)
+  int n_run;                   // Number of times the scheduler has picked the process
+  uint rtime;                  // Number of ticks the program has run for
+  uint tw_time;                // Total wait time
+  struct context *context;     // swtch() here to run process
+  pde_t* pgdir;                // Page table, vm->pgdir
+  char *kstack;                // Bottom of kernel stack for this process (last hot field)
+
+  // MLFQ accounting, the process tree and the process's own state.
+  uint q[5];                   // Number of ticks received in each queue
+  struct trapframe *tf;        // Trap frame for current syscall
+  struct vmspace *vm;          // Address space, shared with threads
+  struct proc *parent;         // Parent process
+  struct proc *children;       // Children that have not exited
+  struct proc *zombies;        // Children that have exited, for wait() and join()
+  struct proc *sibnext;        // On parent->children or parent->zombies
+  struct proc *sibprev;
+  struct proc *next;           // ptable.all, in order of creation
+  struct proc *prev;
+  int vforked;                 // Borrowing the parent's address space until exec or exit
+  int thread;                  // Made by clone(): reaped by join(), not wait()
+  int multithreaded;           // Address space shared by clone()
+
+  // Cold.
+  struct fdtable *fdt;         // Open files, shared with threads
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
   uint ctime;                  // Creation time of the process (Number of ticks till creation)
   uint etime;                  // End time of the process (Number of ticks till process ends)
-  uint rtime;                  // Number of ticks the program has run for
-  uint w_time;                 // Number of ticks the process has been waiting for (Reset to 0 everytime it gets CPU)
-  uint tw_time;                // Total wait time
-  int n_run;                   // Number of times the scheduler has picked the process
-  uint priority;               // Priority of the task (Applicable for PBS)
-  uint cur_q;                  // Current queue of the process (Applicable for MLFQ)
-  uint q[5];                   // Number of ticks received in each queue
-  uint n_ticks;                // Number of ticks the process has executed for (reset everytime it changes queue or gets CPU)
-};
+  uint nfault;                 // Page faults that mapped a page (demand-zero, file or copy-on-write)
+  uint64 execns;               // nsclock() at exec, until the first page fault
+  uint ustack;                 // Thread's user stack, returned by join()
+} __attribute__((aligned(CACHELINE)));
 
 // Process memory is laid out contiguously, low addresses first:
 //   text
@@ -0,0 +1,102 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Process table scaling.  For growing numbers of processes, fork
+// that many children, which sleep reading a pipe, and report the
+// fork time per child, the round-trip time of a pipe ping-pong with
+// one more child while they all sleep, and the time per child to
+// let them exit and wait() for them.  With the process table walked
+// only where it has to be, the round trip should not grow with the
+// number of sleepers.
+
+#define NROUND 200
+
+int counts[] = { 16, 64, 256, 1024, 2048 };
+
+// Ping-pong one byte NROUND times with a child; returns us per round.
+uint
+pingpong(void)
+{
+  int i, pid, ab[2], ba[2];
+  uint64 t0, t1;
+  char c;
+
+  if(pipe(ab) < 0 || pipe(ba) < 0){
+    printf(1, "procbench: pipe failed\n");
+    exit();
+  }
+  if((pid = fork()) < 0){
+    printf(1, "procbench: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    for(i = 0; i < NROUND; i++){
+      read(ab[0], &c, 1);
+      write(ba[1], &c, 1);
+    }
+    exit();
+  }
+  c = 0;
+  clockns(&t0);
+  for(i = 0; i < NROUND; i++){
+    write(ab[1], &c, 1);
+    read(ba[0], &c, 1);
+  }
+  clockns(&t1);
+  wait();
+  close(ab[0]);
+  close(ab[1]);
+  close(ba[0]);
+  close(ba[1]);
+  return nsdiv(t1 - t0, 1000 * NROUND);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, n, max, pid, fds[2];
+  uint64 t0, t1;
+  uint forkus, rtt, waitus;
+  char c;
+
+  max = argc > 1 ? atoi(argv[1]) : 2048;
+  printf(1, "procs  fork us/child  round trip us  exit+wait us/child\n");
+  for(i = 0; i < sizeof(counts)/sizeof(counts[0]) && counts[i] <= max; i++){
+    if(pipe(fds) < 0){
+      printf(1, "procbench: pipe failed\n");
+      exit();
+    }
+    clockns(&t0);
+    for(n = 0; n < counts[i]; n++){
+      if((pid = fork()) < 0)
+        break;
+      if(pid == 0){
+        close(fds[1]);
+        read(fds[0], &c, 1);
+        exit();
+      }
+    }
+    clockns(&t1);
+    if(n == 0){
+      printf(1, "procbench: fork failed\n");
+      exit();
+    }
+    forkus = nsdiv(t1 - t0, 1000 * n);
+    rtt = pingpong();
+
+    clockns(&t0);
+    close(fds[1]);
+    for(j = 0; j < n; j++)
+      wait();
+    clockns(&t1);
+    close(fds[0]);
+    waitus = nsdiv(t1 - t0, 1000 * n);
+    printf(1, "%d  %d  %d  %d\n", n, forkus, rtt, waitus);
+    if(n < counts[i]){
+      printf(1, "procbench: fork failed after %d children\n", n);
+      break;
+    }
+  }
+  exit();
+}
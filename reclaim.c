@@ -0,0 +1,96 @@
+// Memory pressure.
+//
+// Free memory is kept above two watermarks.  When a user page
+// allocation (kallocuser()) finds fewer than SWAPLOW free pages, it
+// first asks the shrinkers, kernel caches that can give pages back
+// (slab.c, mmap.c), to free the difference, and then swaps user
+// pages out.  If free memory is still below OOMLOW, the remaining
+// pages are kept for the kernel and the OOM killer picks a process
+// to kill by resident size and priority (oomkill() in proc.c); the
+// allocation waits for it to exit, for at most OOMWAIT ticks.
+//
+// KSTAT_LOWMEM, KSTAT_RECLAIM and KSTAT_OOMKILL count the events,
+// and mem_info prints them along with what each shrinker freed.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "kstat.h"
+
+#define NSHRINKER 8
+#define OOMWAIT  50   // ticks to wait for an OOM victim to exit
+
+struct shrinker {
+  char *name;
+  int (*shrink)(int);   // free up to n pages, return how many
+  uint freed;
+};
+
+static struct shrinker shrinkers[NSHRINKER];
+static int nshrinker;
+
+// Register fn as a shrinker.  Called during boot, from the init
+// function of the cache, before other CPUs start.
+void
+addshrinker(char *name, int (*fn)(int))
+{
+  if(nshrinker == NSHRINKER)
+    panic("addshrinker");
+  shrinkers[nshrinker].name = name;
+  shrinkers[nshrinker].shrink = fn;
+  nshrinker++;
+}
+
+// Ask the shrinkers, in order, for n pages.  Returns the number of
+// pages they freed.  The caller must not hold any spinlock.
+int
+reclaim(int n)
+{
+  struct shrinker *s;
+  int freed, k;
+
+  freed = 0;
+  for(s = shrinkers; s < &shrinkers[nshrinker] && freed < n; s++){
+    k = s->shrink(n - freed);
+    __sync_fetch_and_add(&s->freed, k);
+    freed += k;
+  }
+  kstatadd(KSTAT_RECLAIM, freed);
+  return freed;
+}
+
+// Out of memory even after reclaiming and swapping: kill a process
+// and wait for its memory.  Returns 0 if free memory is back above
+// OOMLOW, or -1 if the allocation should fail, as it must when the
+// victim is the caller.
+int
+oom(void)
+{
+  struct proc *curproc = myproc();
+  int pid, t;
+
+  if(curproc->killed)
+    return -1;
+  if((pid = oomkill()) < 0 || pid == curproc->pid)
+    return -1;
+  for(t = 0; t < OOMWAIT && kfreepages() < OOMLOW; t++)
+    if(sleepticks(1) < 0)
+      break;
+  return kfreepages() < OOMLOW ? -1 : 0;
+}
+
+// Print the pages freed by each shrinker and the OOM kills.
+void
+reclaiminfo(void)
+{
+  struct shrinker *s;
+
+  cprintf("lowmem: %d times below %d free pages, %d pages reclaimed, "
+          "%d OOM kills\n", kstatget(KSTAT_LOWMEM), SWAPLOW,
+          kstatget(KSTAT_RECLAIM), kstatget(KSTAT_OOMKILL));
+  for(s = shrinkers; s < &shrinkers[nshrinker]; s++)
+    cprintf("reclaim %s: %d pages\n", s->name, s->freed);
+}
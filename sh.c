@@ -3,6 +3,7 @@
 #include "types.h"
 #include "user.h"
 #include "fcntl.h"
+#include "spawn.h"
 
 // Parsed command representation
 #define EXEC  1
@@ -52,6 +53,7 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
 
 // Execute cmd.  Never returns.
 void
@@ -130,6 +132,89 @@ runcmd(struct cmd *cmd)
   exit();
 }
 
+// Can cmd run as spawn() calls from the shell itself, on top of
+// nact file actions?  Pipelines of simple commands with
+// redirections can; lists, background jobs and blocks need a
+// forked shell.
+int
+spawnable(struct cmd *cmd, int nact)
+{
+  struct pipecmd *pcmd;
+
+  switch(cmd->type){
+  case EXEC:
+    return nact <= NSPAWNACT;
+  case REDIR:
+    return spawnable(((struct redircmd*)cmd)->cmd, nact+1);
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    return spawnable(pcmd->left, nact+3) && spawnable(pcmd->right, nact+3);
+  }
+  return 0;
+}
+
+// Start the commands in cmd, which spawnable() accepted, with the
+// file actions act[0..nact-1] applied first.  Returns the number
+// of processes started.
+int
+spawncmd(struct cmd *cmd, struct spawnact *act, int nact)
+{
+  int p[2], n, fd;
+  struct execcmd *ecmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  switch(cmd->type){
+  case EXEC:
+    ecmd = (struct execcmd*)cmd;
+    if(ecmd->argv[0] == 0)
+      return 0;
+    act[nact].op = 0;
+    if(spawn(ecmd->argv[0], ecmd->argv, act) < 0){
+      printf(2, "exec %s failed\n", ecmd->argv[0]);
+      return 0;
+    }
+    return 1;
+
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    // Open the target here first: a failed SPAWN_OPEN would make
+    // spawn() fail and look like a failed exec.
+    if((fd = open(rcmd->file, rcmd->mode)) < 0){
+      printf(2, "open %s failed\n", rcmd->file);
+      return 0;
+    }
+    close(fd);
+    act[nact].op = SPAWN_OPEN;
+    act[nact].fd = rcmd->fd;
+    act[nact].arg = rcmd->mode;
+    act[nact].path = rcmd->file;
+    return spawncmd(rcmd->cmd, act, nact+1);
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    if(pipe(p) < 0){
+      printf(2, "pipe failed\n");
+      return 0;
+    }
+    act[nact].op = SPAWN_DUP2;
+    act[nact].fd = 1;
+    act[nact].arg = p[1];
+    act[nact+1].op = SPAWN_CLOSE;
+    act[nact+1].fd = p[0];
+    act[nact+2].op = SPAWN_CLOSE;
+    act[nact+2].fd = p[1];
+    n = spawncmd(pcmd->left, act, nact+3);
+    act[nact].fd = 0;
+    act[nact].arg = p[0];
+    n += spawncmd(pcmd->right, act, nact+3);
+    close(p[0]);
+    close(p[1]);
+    return n;
+  }
+  return 0;
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -145,7 +230,9 @@ int
 main(void)
 {
   static char buf[100];
-  int fd;
+  static struct spawnact act[NSPAWNACT+1];
+  struct cmd *cmd;
+  int fd, n;
 
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -164,9 +251,18 @@ main(void)
         printf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait();
+    if((cmd = parsecmd(buf)) == 0)
+      continue;
+    if(spawnable(cmd, 0)){
+      // No need to copy the shell to run a program.
+      for(n = spawncmd(cmd, act, 0); n > 0; n--)
+        wait();
+    } else {
+      if(fork1() == 0)
+        runcmd(cmd);
+      wait();
+    }
+    freecmd(cmd);
   }
   exit();
 }
@@ -324,6 +420,18 @@ struct cmd *parsepipe(char**, char*);
 struct cmd *parseexec(char**, char*);
 struct cmd *nulterminate(struct cmd*);
 
+// The shell parses commands itself, so a syntax error must not
+// exit: it is noted here and parsecmd() returns 0.
+int parseerr;
+
+void
+syntax(char *msg)
+{
+  if(!parseerr)
+    printf(2, "%s\n", msg);
+  parseerr = 1;
+}
+
 struct cmd*
 parsecmd(char *s)
 {
@@ -331,11 +439,16 @@ parsecmd(char *s)
   struct cmd *cmd;
 
   es = s + strlen(s);
+  parseerr = 0;
   cmd = parseline(&s, es);
   peek(&s, es, "");
-  if(s != es){
+  if(s != es && !parseerr){
     printf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntax("syntax");
+  }
+  if(parseerr){
+    freecmd(cmd);
+    return 0;
   }
   nulterminate(cmd);
   return cmd;
@@ -379,8 +492,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      syntax("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -406,7 +521,7 @@ parseblock(char **ps, char *es)
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
   if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+    syntax("syntax - missing )");
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -431,13 +546,17 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      syntax("syntax");
+      break;
+    }
+    if(argc >= MAXARGS-1){
+      syntax("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
@@ -491,3 +610,41 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+// Free the command tree built by parsecmd().
+void
+freecmd(struct cmd *cmd)
+{
+  struct backcmd *bcmd;
+  struct listcmd *lcmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    freecmd(rcmd->cmd);
+    break;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    freecmd(pcmd->left);
+    freecmd(pcmd->right);
+    break;
+
+  case LIST:
+    lcmd = (struct listcmd*)cmd;
+    freecmd(lcmd->left);
+    freecmd(lcmd->right);
+    break;
+
+  case BACK:
+    bcmd = (struct backcmd*)cmd;
+    freecmd(bcmd->cmd);
+    break;
+  }
+  free(cmd);
+}
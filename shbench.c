@@ -0,0 +1,88 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "kstat.h"
+
+// Many copies of one program.  Starts N shells that all read one
+// pipe and write their prompts to another, waits until every one
+// has printed "$ ", and reports the average exec latency (exec() to
+// first instruction, KSTAT_EXECNS), the pages read from sh against
+// those served by the image cache, and how many free pages each
+// shell cost.  Closing the input pipe makes them all exit.
+
+#define N 50
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, got, started, in[2], out[2];
+  uint e0, ns0, pg0, hit0, execs;
+  int free0;
+  uint64 t0, t1;
+  char *args[2], buf[64];
+
+  n = argc > 1 ? atoi(argv[1]) : N;
+  if(n < 1 || n > N){
+    printf(2, "usage: shbench [shells <= %d]\n", N);
+    exit();
+  }
+  if(pipe(in) < 0 || pipe(out) < 0){
+    printf(1, "shbench: pipe failed\n");
+    exit();
+  }
+  args[0] = "sh";
+  args[1] = 0;
+  e0 = kstat(KSTAT_EXEC);
+  ns0 = kstat(KSTAT_EXECNS);
+  pg0 = kstat(KSTAT_FILEPG);
+  hit0 = kstat(KSTAT_IMGHIT);
+  free0 = kstat(KSTAT_FREEPG);
+  clockns(&t0);
+  for(started = 0; started < n; started++){
+    i = fork();
+    if(i < 0){
+      printf(1, "shbench: fork failed\n");
+      break;
+    }
+    if(i == 0){
+      close(0);
+      dup(in[0]);
+      close(1);
+      dup(out[1]);
+      close(2);
+      dup(out[1]);
+      close(in[0]);
+      close(in[1]);
+      close(out[0]);
+      close(out[1]);
+      exec("sh", args);
+      exit();
+    }
+  }
+  close(in[0]);
+  close(out[1]);
+
+  // Each shell prints one "$ " once it is up.
+  for(got = 0; got < 2 * started; got += i)
+    if((i = read(out[0], buf, sizeof(buf))) <= 0)
+      break;
+  clockns(&t1);
+  execs = kstat(KSTAT_EXEC) - e0;
+  printf(1, "shbench: %d shells up in %d ms\n", got / 2,
+         nsdiv(t1 - t0, 1000000));
+  if(execs > 0)
+    printf(1, "  exec to first instruction: %d us\n",
+           (kstat(KSTAT_EXECNS) - ns0) / execs / 1000);
+  printf(1, "  sh pages read from file: %d, from the image cache: %d\n",
+         kstat(KSTAT_FILEPG) - pg0, kstat(KSTAT_IMGHIT) - hit0);
+  if(started > 0)
+    printf(1, "  free pages per shell: %d\n",
+           (free0 - kstat(KSTAT_FREEPG)) / started);
+  mem_info();
+
+  close(in[1]);
+  for(i = 0; i < started; i++)
+    wait();
+  close(out[0]);
+  exit();
+}
@@ -0,0 +1,145 @@
+// Shared memory segments.
+//
+// A segment is a named group of physical pages.  shm_open() maps a
+// segment into the calling process, creating it on first use, and
+// shm_close() unmaps it; a child inherits its parent's mappings
+// across fork().  Every mapping holds a reference on the segment,
+// and the segment is destroyed when its last mapping goes away.
+//
+// The pages are reference counted by kalloc: the segment holds one
+// reference and every mapping one more, so unmapping is only a
+// matter of clearing PTEs (deallocuvm(), freevm()).
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+
+#define SHMNAME 16   // maximum segment name length
+
+struct shm {
+  char name[SHMNAME];
+  int ref;                  // mappings; 0 if the slot is free
+  int npages;
+  char *pages[SHMPAGES];
+};
+
+struct {
+  struct spinlock lock;
+  struct shm seg[NSHM];
+} shmtable;
+
+void
+shminit(void)
+{
+  initlock(&shmtable.lock, "shm");
+}
+
+// Find the segment called name, or create it with size bytes,
+// and take a reference to it.  Returns the segment id, or -1 if
+// an existing segment is smaller than size or no segment can be
+// created.
+int
+shmget(char *name, uint size)
+{
+  struct shm *s, *free;
+  int i, n;
+
+  n = PGROUNDUP(size) / PGSIZE;
+  if(n == 0 || n > SHMPAGES)
+    return -1;
+  acquire(&shmtable.lock);
+  free = 0;
+  for(s = shmtable.seg; s < &shmtable.seg[NSHM]; s++){
+    if(s->ref == 0){
+      if(free == 0)
+        free = s;
+      continue;
+    }
+    if(strncmp(s->name, name, SHMNAME) == 0){
+      if(n > s->npages){
+        release(&shmtable.lock);
+        return -1;
+      }
+      s->ref++;
+      release(&shmtable.lock);
+      return s - shmtable.seg;
+    }
+  }
+  if((s = free) == 0){
+    release(&shmtable.lock);
+    return -1;
+  }
+  for(i = 0; i < n; i++){
+    if((s->pages[i] = kzalloc()) == 0){
+      while(--i >= 0)
+        kfree(s->pages[i]);
+      release(&shmtable.lock);
+      return -1;
+    }
+  }
+  safestrcpy(s->name, name, SHMNAME);
+  s->npages = n;
+  s->ref = 1;
+  release(&shmtable.lock);
+  return s - shmtable.seg;
+}
+
+// Size of segment id in bytes.
+uint
+shmsize(int id)
+{
+  return shmtable.seg[id].npages * PGSIZE;
+}
+
+// Map segment id at va in pgdir.  The caller holds a reference.
+int
+shmmap(pde_t *pgdir, int id, uint va)
+{
+  struct shm *s = &shmtable.seg[id];
+
+  return mapshared(pgdir, va, s->pages, s->npages);
+}
+
+// Take another reference to segment id (fork).
+void
+shmdup(int id)
+{
+  acquire(&shmtable.lock);
+  shmtable.seg[id].ref++;
+  release(&shmtable.lock);
+}
+
+// Drop a reference to segment id, destroying it with the last one.
+// Pages still mapped somewhere live on until they are unmapped.
+void
+shmrelease(int id)
+{
+  struct shm *s = &shmtable.seg[id];
+  int i;
+
+  acquire(&shmtable.lock);
+  if(s->ref <= 0)
+    panic("shmrelease");
+  if(--s->ref == 0){
+    for(i = 0; i < s->npages; i++)
+      kfree(s->pages[i]);
+    s->npages = 0;
+    s->name[0] = 0;
+  }
+  release(&shmtable.lock);
+}
+
+// Print the live segments.
+void
+shminfo(void)
+{
+  struct shm *s;
+
+  acquire(&shmtable.lock);
+  for(s = shmtable.seg; s < &shmtable.seg[NSHM]; s++)
+    if(s->ref)
+      cprintf("shm %s: %d pages, %d mappings\n", s->name, s->npages, s->ref);
+  release(&shmtable.lock);
+}
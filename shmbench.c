@@ -0,0 +1,147 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Producer/consumer throughput: shared memory against pipes.
+// The producer sends NBYTES in CHUNK-sized messages and the consumer
+// sums every byte it receives.
+//
+// Through a pipe each byte is copied twice, into and out of the
+// kernel's 512-byte ring, and every full or empty ring costs a
+// sleep/wakeup.  Through shared memory the producer writes straight
+// into a ring of NSLOT chunks that the consumer reads in place; the
+// two only share the head and tail counters, and poll them, so run
+// with at least two CPUs.
+
+#define NBYTES  (8*1024*1024)
+#define CHUNK   4096
+#define NSLOT   15
+
+struct ring {
+  volatile uint head;   // chunks produced
+  volatile uint tail;   // chunks consumed
+  char pad[CHUNK - 2*sizeof(uint)];
+  char slot[NSLOT][CHUNK];
+};
+
+char buf[CHUNK];
+
+void
+fill(char *p, uint seq)
+{
+  int i;
+
+  for(i = 0; i < CHUNK; i++)
+    p[i] = seq + i;
+}
+
+uint
+sum(char *p)
+{
+  uint s;
+  int i;
+
+  s = 0;
+  for(i = 0; i < CHUNK; i++)
+    s += (uchar)p[i];
+  return s;
+}
+
+void
+report(char *what, uint64 t0, uint64 t1)
+{
+  uint us;
+
+  us = nsdiv(t1 - t0, 1000);
+  printf(1, "%s: %d KB in %d us, %d KB/s\n", what, NBYTES / 1024, us,
+         (NBYTES / 1024) * 1000 / (us / 1000 + 1));
+}
+
+void
+pipebench(void)
+{
+  int fds[2], n, got;
+  uint seq, s;
+  uint64 t0, t1;
+
+  if(pipe(fds) < 0){
+    printf(1, "shmbench: pipe failed\n");
+    exit();
+  }
+  clockns(&t0);
+  if(fork() == 0){
+    close(fds[0]);
+    for(seq = 0; seq < NBYTES / CHUNK; seq++){
+      fill(buf, seq);
+      if(write(fds[1], buf, CHUNK) != CHUNK){
+        printf(1, "shmbench: pipe write failed\n");
+        exit();
+      }
+    }
+    exit();
+  }
+  close(fds[1]);
+  s = 0;
+  for(seq = 0; seq < NBYTES / CHUNK; seq++){
+    for(got = 0; got < CHUNK; got += n){
+      if((n = read(fds[0], buf + got, CHUNK - got)) <= 0){
+        printf(1, "shmbench: pipe read failed\n");
+        exit();
+      }
+    }
+    s += sum(buf);
+  }
+  wait();
+  clockns(&t1);
+  close(fds[0]);
+  report("pipe", t0, t1);
+  printf(1, "  checksum %x\n", s);
+}
+
+void
+shmbench(void)
+{
+  struct ring *r;
+  uint seq, s;
+  uint64 t0, t1;
+
+  r = (struct ring*)shm_open("shmbench", sizeof(struct ring));
+  if(r == (struct ring*)-1){
+    printf(1, "shmbench: shm_open failed\n");
+    exit();
+  }
+  r->head = r->tail = 0;
+  clockns(&t0);
+  if(fork() == 0){
+    for(seq = 0; seq < NBYTES / CHUNK; seq++){
+      while(r->head - r->tail == NSLOT)
+        ;
+      fill(r->slot[seq % NSLOT], seq);
+      __sync_synchronize();
+      r->head = seq + 1;
+    }
+    exit();
+  }
+  s = 0;
+  for(seq = 0; seq < NBYTES / CHUNK; seq++){
+    while(r->head == seq)
+      ;
+    __sync_synchronize();
+    s += sum(r->slot[seq % NSLOT]);
+    __sync_synchronize();
+    r->tail = seq + 1;
+  }
+  wait();
+  clockns(&t1);
+  shm_close((char*)r);
+  report("shm", t0, t1);
+  printf(1, "  checksum %x\n", s);
+}
+
+int
+main(int argc, char *argv[])
+{
+  pipebench();
+  shmbench();
+  exit();
+}
@@ -0,0 +1,281 @@
+// Slab allocator for small fixed-size kernel objects.
+//
+// A cache (struct kmem_cache) hands out objects of one size.  It
+// carves pages from kalloc() into slabs: a struct slab header at the
+// start of the page followed by as many objects as fit.  Free objects
+// within a slab are chained through their first word.  Slabs with at
+// least one free object sit on the cache's partial list; a slab whose
+// objects are all free goes back to kalloc().
+//
+// Each CPU keeps a small stack of free objects per cache, so most
+// allocations and frees touch only per-CPU data with interrupts off.
+// Objects move between a CPU's stack and the slabs SLAB_BATCH at a
+// time under the cache lock.  Each stack has cache lines of its
+// own, and a cache can ask for its objects to start on a cache line
+// so that objects used by different CPUs do not share one.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+
+#define NKCACHE     16  // maximum number of caches
+#define SLAB_CPU    16  // objects a CPU holds per cache
+#define SLAB_BATCH   8  // objects moved per refill or flush
+
+struct slab {
+  struct slab *next;       // partial list
+  struct slab *prev;
+  struct kmem_cache *cache;
+  uint inuse;              // objects handed out from this slab
+  void *free;              // free objects in this slab
+};
+
+// A CPU's stack of free objects for one cache.
+struct slabcpu {
+  void *obj[SLAB_CPU];
+  int n;
+  uint nalloc;             // kmem_cache_alloc() calls on this CPU
+  uint nfree;              // kmem_cache_free() calls on this CPU
+} __attribute__((aligned(CACHELINE)));
+
+struct kmem_cache {
+  char name[16];
+  uint size;               // object size, rounded up to the alignment
+  uint first;              // offset of the first object in a slab
+  uint perslab;            // objects per slab
+  struct spinlock lock;
+  struct slab *partial;    // slabs with free objects
+  uint nslab;              // pages held by the cache
+  uint inuse;              // objects taken out of slabs
+  struct slabcpu cpu[NCPU];
+};
+
+static struct {
+  struct spinlock lock;
+  int n;
+  struct kmem_cache cache[NKCACHE];
+} kcaches;
+
+static int slabshrink(int);
+
+void
+slabinit(void)
+{
+  initlock(&kcaches.lock, "kcaches");
+  addshrinker("slab", slabshrink);
+}
+
+// Create a cache for objects of size bytes, starting at multiples
+// of align bytes (a power of two; 0 means 4).  Panics if there are
+// too many caches or the object does not fit in a page.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size, uint align)
+{
+  struct kmem_cache *c;
+  uint first;
+
+  if(align < 4)
+    align = 4;
+  size = (size + align - 1) & ~(align - 1);
+  first = (sizeof(struct slab) + align - 1) & ~(align - 1);
+  if(size < sizeof(void*) || size > PGSIZE - first)
+    panic("kmem_cache_create: size");
+  acquire(&kcaches.lock);
+  if(kcaches.n == NKCACHE)
+    panic("kmem_cache_create: too many caches");
+  c = &kcaches.cache[kcaches.n];
+  memset(c, 0, sizeof(*c));
+  safestrcpy(c->name, name, sizeof(c->name));
+  c->size = size;
+  c->first = first;
+  c->perslab = (PGSIZE - first) / size;
+  initlock(&c->lock, c->name);
+  kcaches.n++;
+  release(&kcaches.lock);
+  return c;
+}
+
+// Allocate a page and build a slab of free objects in it.
+// Caller holds c->lock.
+static struct slab*
+newslab(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *p;
+  uint i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->inuse = 0;
+  s->free = 0;
+  p = (char*)s + c->first + (c->perslab - 1) * c->size;
+  for(i = 0; i < c->perslab; i++, p -= c->size){
+    *(void**)p = s->free;
+    s->free = p;
+  }
+  s->prev = 0;
+  s->next = c->partial;
+  if(c->partial)
+    c->partial->prev = s;
+  c->partial = s;
+  c->nslab++;
+  return s;
+}
+
+static void
+unlinkslab(struct kmem_cache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Take up to n objects out of the slabs into obj.
+// Caller holds c->lock.  Returns the number taken.
+static int
+takeobjs(struct kmem_cache *c, void **obj, int n)
+{
+  struct slab *s;
+  int i;
+
+  for(i = 0; i < n; i++){
+    if((s = c->partial) == 0 && (s = newslab(c)) == 0)
+      break;
+    obj[i] = s->free;
+    s->free = *(void**)s->free;
+    s->inuse++;
+    c->inuse++;
+    if(s->free == 0)
+      unlinkslab(c, s);  // full
+  }
+  return i;
+}
+
+// Return n objects to their slabs.  Caller holds c->lock.
+static void
+putobjs(struct kmem_cache *c, void **obj, int n)
+{
+  struct slab *s;
+  int i;
+
+  for(i = 0; i < n; i++){
+    s = (struct slab*)PGROUNDDOWN((uint)obj[i]);
+    if(s->cache != c)
+      panic("kmem_cache_free: wrong cache");
+    if(s->free == 0){
+      // Was full; back on the partial list.
+      s->prev = 0;
+      s->next = c->partial;
+      if(c->partial)
+        c->partial->prev = s;
+      c->partial = s;
+    }
+    *(void**)obj[i] = s->free;
+    s->free = obj[i];
+    s->inuse--;
+    c->inuse--;
+    if(s->inuse == 0){
+      unlinkslab(c, s);
+      c->nslab--;
+      kfree((char*)s);
+    }
+  }
+}
+
+// Allocate an object from cache c.
+// Returns 0 if no memory is available.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  void *p;
+  int id;
+
+  pushcli();
+  id = cpuid();
+  c->cpu[id].nalloc++;
+  if(c->cpu[id].n == 0){
+    acquire(&c->lock);
+    c->cpu[id].n = takeobjs(c, c->cpu[id].obj, SLAB_BATCH);
+    release(&c->lock);
+  }
+  p = 0;
+  if(c->cpu[id].n > 0)
+    p = c->cpu[id].obj[--c->cpu[id].n];
+  popcli();
+  return p;
+}
+
+// Free an object previously returned by kmem_cache_alloc(c).
+void
+kmem_cache_free(struct kmem_cache *c, void *p)
+{
+  int id;
+
+  pushcli();
+  id = cpuid();
+  c->cpu[id].nfree++;
+  if(c->cpu[id].n == SLAB_CPU){
+    acquire(&c->lock);
+    c->cpu[id].n -= SLAB_BATCH;
+    putobjs(c, &c->cpu[id].obj[c->cpu[id].n], SLAB_BATCH);
+    release(&c->lock);
+  }
+  c->cpu[id].obj[c->cpu[id].n++] = p;
+  popcli();
+}
+
+// Shrinker: return the objects in this CPU's stacks to their slabs,
+// freeing the slabs that become empty.  Other CPUs' stacks are only
+// touched by their own CPU.  Returns the number of pages freed.
+static int
+slabshrink(int n)
+{
+  struct kmem_cache *c;
+  uint nslab;
+  int id, freed;
+
+  freed = 0;
+  for(c = kcaches.cache; c < &kcaches.cache[kcaches.n]; c++){
+    pushcli();
+    id = cpuid();
+    acquire(&c->lock);
+    nslab = c->nslab;
+    putobjs(c, c->cpu[id].obj, c->cpu[id].n);
+    c->cpu[id].n = 0;
+    freed += nslab - c->nslab;
+    release(&c->lock);
+    popcli();
+  }
+  return freed;
+}
+
+// Print per-cache memory usage.  Objects sitting in the per-CPU
+// stacks are counted as cached, not in use.
+void
+slabinfo(void)
+{
+  struct kmem_cache *c;
+  int i;
+  uint cached, nalloc, nfree;
+
+  for(c = kcaches.cache; c < &kcaches.cache[kcaches.n]; c++){
+    acquire(&c->lock);
+    cached = nalloc = nfree = 0;
+    for(i = 0; i < NCPU; i++){
+      cached += c->cpu[i].n;
+      nalloc += c->cpu[i].nalloc;
+      nfree += c->cpu[i].nfree;
+    }
+    cprintf("slab %s: %d bytes, %d per slab, %d slabs (%d KB), "
+            "%d in use, %d cached, %d allocs, %d frees\n",
+            c->name, c->size, c->perslab, c->nslab, c->nslab * PGSIZE / 1024,
+            c->inuse - cached, cached, nalloc, nfree);
+    release(&c->lock);
+  }
+}
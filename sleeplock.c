@@ -9,6 +9,11 @@
 #include "proc.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "kstat.h"
+
+// Upper bound on how long acquireadaptive() spins on one holder
+// before rechecking the lock under lk->lk.
+#define ADAPTIVE_SPINS 10000
 
 void
 initsleeplock(struct sleeplock *lk, char *name)
@@ -16,17 +21,70 @@ initsleeplock(struct sleeplock *lk, char *name)
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->owner = 0;
+  lk->waiters = 0;
   lk->pid = 0;
 }
 
+// Block until lk is free.  Called with lk->lk held.
+static void
+sleeponlock(struct sleeplock *lk)
+{
+  kstatinc(KSTAT_LOCKSLEEP);
+  lk->waiters++;
+  sleep(lk, &lk->lk);
+  lk->waiters--;
+}
+
 void
 acquiresleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
   while (lk->locked) {
-    sleep(lk, &lk->lk);
+    sleeponlock(lk);
+  }
+  lk->locked = 1;
+  lk->owner = myproc();
+  lk->pid = myproc()->pid;
+  release(&lk->lk);
+}
+
+// Adaptive variant of acquiresleep() for locks held across short
+// critical sections (e.g. buffer locks around a memmove).  While the
+// holder is RUNNING on another CPU it will most likely release the
+// lock soon, so spin instead of paying for sleep()/wakeup() and two
+// context switches.  If the holder is not running it may be blocked
+// for a long time (e.g. on disk I/O), so fall back to sleeping.
+void
+acquireadaptive(struct sleeplock *lk)
+{
+  struct proc *owner;
+  int i, spun;
+
+  spun = 0;
+  acquire(&lk->lk);
+  while (lk->locked) {
+    owner = lk->owner;
+    if(owner == 0 || owner == myproc() || owner->state != RUNNING){
+      sleeponlock(lk);
+      spun = 0;
+      continue;
+    }
+    release(&lk->lk);
+    for(i = 0; i < ADAPTIVE_SPINS; i++){
+      if(*(volatile uint*)&lk->locked == 0 ||
+         *(struct proc* volatile*)&lk->owner != owner ||
+         *(volatile enum procstate*)&owner->state != RUNNING)
+        break;
+      pause();
+    }
+    spun = 1;
+    acquire(&lk->lk);
   }
+  if(spun)
+    kstatinc(KSTAT_LOCKSPIN);
   lk->locked = 1;
+  lk->owner = myproc();
   lk->pid = myproc()->pid;
   release(&lk->lk);
 }
@@ -36,8 +94,11 @@ releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
   lk->locked = 0;
+  lk->owner = 0;
   lk->pid = 0;
-  wakeup(lk);
+  // Only pay for wakeup() (and ptable.lock) if someone is asleep.
+  if(lk->waiters)
+    wakeup(lk);
   release(&lk->lk);
 }
 
@@ -2,6 +2,8 @@
 struct sleeplock {
   uint locked;       // Is the lock held?
   struct spinlock lk; // spinlock protecting this sleep lock
+  struct proc *owner; // Process holding lock (checked by adaptive spinners)
+  int waiters;       // Number of processes sleeping on this lock
   
   // For debugging:
   char *name;        // Name of lock.
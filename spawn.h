@@ -0,0 +1,14 @@
+// File actions for spawn(path, argv, acts).  The child starts with
+// the caller's open files, then applies acts in order up to an
+// entry whose op is 0.  acts may be 0 for none.
+#define SPAWN_CLOSE  1  // close fd
+#define SPAWN_DUP2   2  // make fd a copy of arg, closing fd first
+#define SPAWN_OPEN   3  // open path with mode arg (fcntl.h) as fd
+#define NSPAWNACT   16  // most actions per spawn()
+
+struct spawnact {
+  int op;
+  int fd;
+  int arg;
+  char *path;
+};
@@ -0,0 +1,83 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Process launch rate: fork()+exec() against vfork()+exec() and
+// spawn().  Each round starts N copies of this program, which exit
+// at once, and waits for them; it is run with the parent at its
+// normal size and again after growing its heap to BIG bytes and
+// touching every page.
+//
+// fork() copies the parent's page table (copy-on-write) and exec()
+// throws the copy away, so its cost grows with the parent.  vfork()
+// lends the parent's address space to the child until exec(), and
+// spawn() builds the child straight from the executable; neither
+// depends on the parent's size.
+
+#define N    50
+#define BIG  (16*1024*1024)
+
+char *args[] = { "spawnbench", "-x", 0 };
+
+void
+launch(char *what, int how)
+{
+  int i, pid;
+  uint us;
+  uint64 t0, t1;
+
+  clockns(&t0);
+  for(i = 0; i < N; i++){
+    if(how == 0){
+      pid = fork();
+      if(pid == 0){
+        exec(args[0], args);
+        exit();
+      }
+    } else if(how == 1){
+      pid = vfork();
+      if(pid == 0){
+        exec(args[0], args);
+        exit();
+      }
+    } else
+      pid = spawn(args[0], args, 0);
+    if(pid < 0){
+      printf(1, "spawnbench: %s failed\n", what);
+      exit();
+    }
+    wait();
+  }
+  clockns(&t1);
+  us = nsdiv(t1 - t0, 1000);
+  printf(1, "%s: %d launches in %d us, %d us each\n", what, N, us, us / N);
+}
+
+void
+series(char *size)
+{
+  printf(1, "parent %s:\n", size);
+  launch("fork+exec ", 0);
+  launch("vfork+exec", 1);
+  launch("spawn     ", 2);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *p;
+  int i;
+
+  if(argc > 1 && strcmp(argv[1], "-x") == 0)
+    exit();
+
+  series("small");
+  if((p = sbrk(BIG)) == (char*)-1){
+    printf(1, "spawnbench: sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < BIG; i += 4096)
+    p[i] = 1;
+  series("16 MB");
+  exit();
+}
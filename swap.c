@@ -0,0 +1,219 @@
+// Swapping of user pages to disk.
+//
+// mkfs reserves SWAPSIZE blocks after the file system (sb.swapstart,
+// sb.nswap), divided into page-sized slots.  When free memory drops
+// below SWAPLOW pages, kallocuser() evicts user pages until it is
+// above again.  Victims are picked by a clock over every process's
+// page table (swapvictim() in proc.c): a page whose PTE_A bit is set
+// gets a second chance, with the bit cleared.
+//
+// An evicted page's PTE keeps its flags, with PTE_P clear, PTE_SWAP
+// set and the slot number in place of the physical page number.
+// pagefault() reads the page back with swapin().  fork() shares
+// slots between parent and child, so slots are reference counted
+// like physical pages.  Only pages mapped exactly once are evicted;
+// pages shared by copy-on-write, shm or a shared file mapping stay
+// resident.
+//
+// Swap I/O goes straight to the disk through one private buffer,
+// bypassing the buffer cache.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "kstat.h"
+
+#define SLOTBLOCKS (PGSIZE/BSIZE)      // disk blocks per slot
+#define NSLOT      (SWAPSIZE/SLOTBLOCKS)
+
+struct {
+  struct spinlock lock;
+  uint dev;
+  uint start;            // first swap block
+  uint nslot;            // 0 if there is no swap space
+  uint used;             // slots referenced or being written
+  uchar ref[NSLOT];      // PTEs naming each slot
+  uchar busy[NSLOT];     // being written out
+  uint nout;             // pages written out
+  uint nin;              // pages read back
+  struct buf buf;        // for swap I/O; buf.lock serializes it
+} swap;
+
+// Find the swap space on dev.  Must be called from process
+// context, after iinit().
+void
+swapinit(int dev)
+{
+  struct superblock sb;
+
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.buf.lock, "swapbuf");
+  readsb(dev, &sb);
+  swap.dev = dev;
+  swap.start = sb.swapstart;
+  swap.nslot = sb.nswap / SLOTBLOCKS;
+  if(swap.nslot > NSLOT)
+    swap.nslot = NSLOT;
+}
+
+// Allocate a slot with one reference, marked busy.
+// Returns the slot, or -1 if swap space is full.
+static int
+slotalloc(void)
+{
+  int i;
+
+  acquire(&swap.lock);
+  for(i = 0; i < swap.nslot; i++){
+    if(swap.ref[i] == 0 && !swap.busy[i]){
+      swap.ref[i] = 1;
+      swap.busy[i] = 1;
+      swap.used++;
+      release(&swap.lock);
+      return i;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Add a reference to slot (fork).
+void
+swapdup(uint slot)
+{
+  acquire(&swap.lock);
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// Drop a reference to slot.  A slot still being written out is
+// freed when the write finishes.
+void
+swapfree(uint slot)
+{
+  acquire(&swap.lock);
+  if(swap.ref[slot] == 0)
+    panic("swapfree");
+  if(--swap.ref[slot] == 0 && !swap.busy[slot])
+    swap.used--;
+  release(&swap.lock);
+}
+
+// Read or write the page in slot.
+static void
+swapio(uint slot, char *page, int write)
+{
+  struct buf *b = &swap.buf;
+  int i;
+
+  acquiresleep(&b->lock);
+  for(i = 0; i < SLOTBLOCKS; i++){
+    b->dev = swap.dev;
+    b->blockno = swap.start + slot*SLOTBLOCKS + i;
+    if(write){
+      memmove(b->data, page + i*BSIZE, BSIZE);
+      b->flags = B_DIRTY;
+    } else
+      b->flags = 0;
+    iderw(b);
+    if(!write)
+      memmove(page + i*BSIZE, b->data, BSIZE);
+  }
+  releasesleep(&b->lock);
+}
+
+// Evict one user page.  Returns 0, or -1 if swap space is full
+// or no page can be evicted.
+static int
+swapout(void)
+{
+  char *page;
+  int slot;
+
+  if((slot = slotalloc()) < 0)
+    return -1;
+  if((page = swapvictim(slot)) == 0){
+    acquire(&swap.lock);
+    swap.ref[slot] = swap.busy[slot] = 0;
+    swap.used--;
+    release(&swap.lock);
+    return -1;
+  }
+  swapio(slot, page, 1);
+  kfree(page);
+  acquire(&swap.lock);
+  swap.busy[slot] = 0;
+  if(swap.ref[slot] == 0)
+    swap.used--;
+  swap.nout++;
+  wakeup(&swap.busy[slot]);
+  release(&swap.lock);
+  kstatinc(KSTAT_SWAPOUT);
+  return 0;
+}
+
+// Read the page that pte says is swapped out back into memory and
+// map it.  Returns 0, or -1 if out of memory.
+int
+swapin(pte_t *pte)
+{
+  char *mem;
+  pte_t old;
+  uint slot;
+
+  old = *pte;
+  slot = PTE_ADDR(old) / PGSIZE;
+  if((mem = kallocuser(0)) == 0)
+    return -1;
+  acquire(&swap.lock);
+  while(swap.busy[slot])
+    sleep(&swap.busy[slot], &swap.lock);
+  swap.nin++;
+  release(&swap.lock);
+  swapio(slot, mem, 0);
+  // Another thread of the process may have read it in first.
+  if(!__sync_bool_compare_and_swap(pte, old, V2P(mem) | (PTE_FLAGS(old) & ~PTE_SWAP) | PTE_P | PTE_A)){
+    kfree(mem);
+    return 0;
+  }
+  swapfree(slot);
+  kstatinc(KSTAT_SWAPIN);
+  return 0;
+}
+
+// Allocate a page for user memory, zeroed if zero is set.  If free
+// memory is low, kernel caches are shrunk and user pages swapped out
+// first, so that the kernel keeps SWAPLOW pages for page tables,
+// stacks and buffers; below OOMLOW a process is killed to make room
+// (see reclaim.c).  Returns 0 if out of memory.  The caller must not
+// hold any spinlock.
+char*
+kallocuser(int zero)
+{
+  if(kfreepages() < SWAPLOW){
+    kstatinc(KSTAT_LOWMEM);
+    reclaim(SWAPLOW - kfreepages());
+    while(kfreepages() < SWAPLOW && swapout() == 0)
+      ;
+    if(kfreepages() < OOMLOW && oom() < 0)
+      return 0;
+  }
+  return zero ? kzalloc() : kalloc();
+}
+
+// Print swap space usage.
+void
+swapinfo(void)
+{
+  acquire(&swap.lock);
+  cprintf("swap: %d of %d slots in use (%d KB), %d pages out, %d in\n",
+          swap.used, swap.nslot, swap.used * (PGSIZE/1024),
+          swap.nout, swap.nin);
+  release(&swap.lock);
+}
@@ -0,0 +1,58 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "kstat.h"
+
+// Context switch benchmark.  Two processes pass a byte back and
+// forth over a pair of pipes NROUND times; every hand-off blocks
+// one process and wakes the other, so each round trip costs two
+// sleep/wakeup switches.  Reports the time per one-way hand-off and
+// the number of context switches counted by the kernel.
+// Run on a single CPU (make qemu CPUS=1) for the pure switch cost.
+
+#define NROUND 5000
+
+int
+main(int argc, char *argv[])
+{
+  int ab[2], ba[2], i, pid, sw0;
+  uint64 t0, t1;
+  uint ns;
+  char c;
+
+  if(pipe(ab) < 0 || pipe(ba) < 0){
+    printf(1, "swtchbench: pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "swtchbench: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    for(i = 0; i < NROUND; i++){
+      if(read(ab[0], &c, 1) != 1)
+        break;
+      write(ba[1], &c, 1);
+    }
+    exit();
+  }
+
+  c = 'x';
+  sw0 = kstat(KSTAT_SWTCH);
+  clockns(&t0);
+  for(i = 0; i < NROUND; i++){
+    write(ab[1], &c, 1);
+    if(read(ba[0], &c, 1) != 1){
+      printf(1, "swtchbench: read failed\n");
+      break;
+    }
+  }
+  clockns(&t1);
+  wait();
+
+  ns = nsdiv(t1 - t0, 2 * NROUND);
+  printf(1, "swtchbench: %d round trips, %d ns per hand-off, %d context switches\n",
+         NROUND, ns, kstat(KSTAT_SWTCH) - sw0);
+  exit();
+}
@@ -4,6 +4,9 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "vmspace.h"
 #include "x86.h"
 #include "syscall.h"
 
@@ -13,36 +16,30 @@
 // library system call function. The saved user %esp points
 // to a saved program counter, and then the first argument.
 
-// Fetch the int at addr from the current process.
+// Fetch the int at addr from the current process.  The page is
+// faulted in first, as in argptr().
 int
 fetchint(uint addr, int *ip)
 {
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz || addr+4 > curproc->sz)
+  if(addr >= curproc->vm->sz || addr+4 > curproc->vm->sz)
+    return -1;
+  if(touchuvm(addr, 4) < 0)
     return -1;
   *ip = *(int*)(addr);
   return 0;
 }
 
-// Fetch the nul-terminated string at addr from the current process.
-// Doesn't actually copy the string - just sets *pp to point at it.
+// Copy the nul-terminated string at addr from the current process
+// into buf, which holds max bytes.  The kernel works on the copy:
+// shared memory and other threads could change the user's string,
+// or unmap it, while the kernel uses it.
 // Returns length of string, not including nul.
 int
-fetchstr(uint addr, char **pp)
+fetchstr(uint addr, char *buf, int max)
 {
-  char *s, *ep;
-  struct proc *curproc = myproc();
-
-  if(addr >= curproc->sz)
-    return -1;
-  *pp = (char*)addr;
-  ep = (char*)curproc->sz;
-  for(s = *pp; s < ep; s++){
-    if(*s == 0)
-      return s - *pp;
-  }
-  return -1;
+  return copyinstr(buf, addr, max);
 }
 
 // Fetch the nth 32-bit system call argument.
@@ -52,34 +49,50 @@ argint(int n, int *ip)
   return fetchint((myproc()->tf->esp) + 4 + 4*n, ip);
 }
 
-// Fetch the nth word-sized system call argument as a pointer
-// to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
-int
-argptr(int n, char **pp, int size)
+static int
+fetchptr(int n, char **pp, int size, int write)
 {
   int i;
   struct proc *curproc = myproc();
  
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0 || !uvmvalid(curproc, i, size, write))
+    return -1;
+  if(touchuvm(i, size) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
 }
 
-// Fetch the nth word-sized system call argument as a string pointer.
-// Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// Fetch the nth word-sized system call argument as a pointer
+// to a block of memory of size bytes.  Check that the pointer
+// lies within the process address space, and fault in any part
+// of it that sbrk() has not backed with memory yet.
+int
+argptr(int n, char **pp, int size)
+{
+  return fetchptr(n, pp, size, 0);
+}
+
+// Like argptr(), for a block the kernel will write to: it must
+// not be part of a read-only mapping.
+int
+argptrw(int n, char **pp, int size)
+{
+  return fetchptr(n, pp, size, 1);
+}
+
+// Fetch the nth word-sized system call argument as a string,
+// copied into buf, which holds max bytes (see fetchstr()).
+// Fails if the string is not nul-terminated within max bytes.
 int
-argstr(int n, char **pp)
+argstr(int n, char *buf, int max)
 {
   int addr;
   if(argint(n, &addr) < 0)
     return -1;
-  return fetchstr(addr, pp);
+  return fetchstr(addr, buf, max);
 }
 
 extern int sys_chdir(void);
@@ -106,6 +119,19 @@ extern int sys_uptime(void);
 extern int sys_waitx(void);
 extern int sys_set_priority(void);
 extern int sys_proc_info(void);
+extern int sys_kstat(void);
+extern int sys_clockns(void);
+extern int sys_mem_info(void);
+extern int sys_shm_open(void);
+extern int sys_shm_close(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_vfork(void);
+extern int sys_spawn(void);
+extern int sys_clone(void);
+extern int sys_join(void);
+extern int sys_futex_wait(void);
+extern int sys_futex_wake(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -132,6 +158,19 @@ static int (*syscalls[])(void) = {
 [SYS_waitx]   sys_waitx,
 [SYS_set_priority] sys_set_priority,
 [SYS_proc_info] sys_proc_info,
+[SYS_kstat]   sys_kstat,
+[SYS_clockns] sys_clockns,
+[SYS_mem_info] sys_mem_info,
+[SYS_shm_open] sys_shm_open,
+[SYS_shm_close] sys_shm_close,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_vfork]   sys_vfork,
+[SYS_spawn]   sys_spawn,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futex_wait] sys_futex_wait,
+[SYS_futex_wake] sys_futex_wake,
 };
 
 void
@@ -22,4 +22,17 @@
 #define SYS_close  21
 #define SYS_waitx  22
 #define SYS_set_priority 23
-#define SYS_proc_info 24
\ No newline at end of file
+#define SYS_proc_info 24
+#define SYS_kstat  25
+#define SYS_clockns 26
+#define SYS_mem_info 27
+#define SYS_shm_open 28
+#define SYS_shm_close 29
+#define SYS_mmap 30
+#define SYS_munmap 31
+#define SYS_vfork 32
+#define SYS_spawn 33
+#define SYS_clone 34
+#define SYS_join  35
+#define SYS_futex_wait 36
+#define SYS_futex_wake 37
@@ -9,12 +9,16 @@
 #include "param.h"
 #include "stat.h"
 #include "mmu.h"
+#include "memlayout.h"
+#include "x86.h"
 #include "proc.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "vmspace.h"
 #include "file.h"
 #include "fcntl.h"
+#include "spawn.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -26,7 +30,7 @@ argfd(int n, int *pfd, struct file **pf)
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if(fd < 0 || fd >= NOFILE || (f=myproc()->fdt->ofile[fd]) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -41,14 +45,17 @@ static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *curproc = myproc();
+  struct fdtable *t = myproc()->fdt;
 
+  acquire(&t->lock);
   for(fd = 0; fd < NOFILE; fd++){
-    if(curproc->ofile[fd] == 0){
-      curproc->ofile[fd] = f;
+    if(t->ofile[fd] == 0){
+      t->ofile[fd] = f;
+      release(&t->lock);
       return fd;
     }
   }
+  release(&t->lock);
   return -1;
 }
 
@@ -73,7 +80,7 @@ sys_read(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptrw(1, &p, n) < 0)
     return -1;
   return fileread(f, p, n);
 }
@@ -95,10 +102,18 @@ sys_close(void)
 {
   int fd;
   struct file *f;
+  struct fdtable *t = myproc()->fdt;
 
   if(argfd(0, &fd, &f) < 0)
     return -1;
-  myproc()->ofile[fd] = 0;
+  // Another thread may have closed fd meanwhile.
+  acquire(&t->lock);
+  if(t->ofile[fd] != f){
+    release(&t->lock);
+    return -1;
+  }
+  t->ofile[fd] = 0;
+  release(&t->lock);
   fileclose(f);
   return 0;
 }
@@ -109,7 +124,7 @@ sys_fstat(void)
   struct file *f;
   struct stat *st;
 
-  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+  if(argfd(0, 0, &f) < 0 || argptrw(1, (void*)&st, sizeof(*st)) < 0)
     return -1;
   return filestat(f, st);
 }
@@ -118,10 +133,10 @@ sys_fstat(void)
 int
 sys_link(void)
 {
-  char name[DIRSIZ], *new, *old;
+  char name[DIRSIZ], new[MAXPATH], old[MAXPATH];
   struct inode *dp, *ip;
 
-  if(argstr(0, &old) < 0 || argstr(1, &new) < 0)
+  if(argstr(0, old, sizeof(old)) < 0 || argstr(1, new, sizeof(new)) < 0)
     return -1;
 
   begin_op();
@@ -186,10 +201,10 @@ sys_unlink(void)
 {
   struct inode *ip, *dp;
   struct dirent de;
-  char name[DIRSIZ], *path;
+  char name[DIRSIZ], path[MAXPATH];
   uint off;
 
-  if(argstr(0, &path) < 0)
+  if(argstr(0, path, sizeof(path)) < 0)
     return -1;
 
   begin_op();
@@ -282,44 +297,38 @@ create(char *path, short type, short major, short minor)
   return ip;
 }
 
-int
-sys_open(void)
+// Open path with mode omode.  Returns the new file, or 0.
+static struct file*
+fileopen(char *path, int omode)
 {
-  char *path;
-  int fd, omode;
   struct file *f;
   struct inode *ip;
 
-  if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
-    return -1;
-
   begin_op();
 
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
     if(ip == 0){
       end_op();
-      return -1;
+      return 0;
     }
   } else {
     if((ip = namei(path)) == 0){
       end_op();
-      return -1;
+      return 0;
     }
     ilock(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
       end_op();
-      return -1;
+      return 0;
     }
   }
 
-  if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
-    if(f)
-      fileclose(f);
+  if((f = filealloc()) == 0){
     iunlockput(ip);
     end_op();
-    return -1;
+    return 0;
   }
   iunlock(ip);
   end_op();
@@ -329,17 +338,35 @@ sys_open(void)
   f->off = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  return f;
+}
+
+int
+sys_open(void)
+{
+  char path[MAXPATH];
+  int fd, omode;
+  struct file *f;
+
+  if(argstr(0, path, sizeof(path)) < 0 || argint(1, &omode) < 0)
+    return -1;
+  if((f = fileopen(path, omode)) == 0)
+    return -1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
   return fd;
 }
 
 int
 sys_mkdir(void)
 {
-  char *path;
+  char path[MAXPATH];
   struct inode *ip;
 
   begin_op();
-  if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
+  if(argstr(0, path, sizeof(path)) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
     end_op();
     return -1;
   }
@@ -352,11 +379,11 @@ int
 sys_mknod(void)
 {
   struct inode *ip;
-  char *path;
+  char path[MAXPATH];
   int major, minor;
 
   begin_op();
-  if((argstr(0, &path)) < 0 ||
+  if((argstr(0, path, sizeof(path))) < 0 ||
      argint(1, &major) < 0 ||
      argint(2, &minor) < 0 ||
      (ip = create(path, T_DEV, major, minor)) == 0){
@@ -371,12 +398,12 @@ sys_mknod(void)
 int
 sys_chdir(void)
 {
-  char *path;
+  char path[MAXPATH];
   struct inode *ip;
   struct proc *curproc = myproc();
   
   begin_op();
-  if(argstr(0, &path) < 0 || (ip = namei(path)) == 0){
+  if(argstr(0, path, sizeof(path)) < 0 || (ip = namei(path)) == 0){
     end_op();
     return -1;
   }
@@ -393,19 +420,20 @@ sys_chdir(void)
   return 0;
 }
 
-int
-sys_exec(void)
+// Fetch the nth system call argument as a user argv array
+// into argv[MAXARG], copying the strings into the page buf.
+static int
+argargv(int n, char **argv, char *buf)
 {
-  char *path, *argv[MAXARG];
-  int i;
+  int i, len, off;
   uint uargv, uarg;
 
-  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0){
+  if(argint(n, (int*)&uargv) < 0)
     return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(argv[0]));
+  off = 0;
   for(i=0;; i++){
-    if(i >= NELEM(argv))
+    if(i >= MAXARG)
       return -1;
     if(fetchint(uargv+4*i, (int*)&uarg) < 0)
       return -1;
@@ -413,10 +441,100 @@ sys_exec(void)
       argv[i] = 0;
       break;
     }
-    if(fetchstr(uarg, &argv[i]) < 0)
+    if((len = fetchstr(uarg, buf + off, PGSIZE - off)) < 0)
+      return -1;
+    argv[i] = buf + off;
+    off += len + 1;
+  }
+  return 0;
+}
+
+int
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG], *buf;
+  int r;
+
+  if(argstr(0, path, sizeof(path)) < 0 || (buf = kalloc()) == 0)
+    return -1;
+  r = -1;
+  if(argargv(1, argv, buf) == 0)
+    r = exec(path, argv);
+  kfree(buf);
+  return r;
+}
+
+// Apply the spawn() file action at user address uact to ofile[],
+// the child-to-be's open files.
+static int
+applyact(uint uact, struct file **ofile)
+{
+  struct spawnact act;
+  struct file *f;
+  char path[MAXPATH];
+
+  if(fetchint(uact, &act.op) < 0 ||
+     fetchint(uact+4, &act.fd) < 0 ||
+     fetchint(uact+8, &act.arg) < 0 ||
+     fetchint(uact+12, (int*)&act.path) < 0)
+    return -1;
+  if(act.fd < 0 || act.fd >= NOFILE)
+    return -1;
+  switch(act.op){
+  case SPAWN_CLOSE:
+    f = 0;
+    break;
+  case SPAWN_DUP2:
+    if(act.arg < 0 || act.arg >= NOFILE || ofile[act.arg] == 0)
+      return -1;
+    f = filedup(ofile[act.arg]);
+    break;
+  case SPAWN_OPEN:
+    if(fetchstr((uint)act.path, path, sizeof(path)) < 0 || (f = fileopen(path, act.arg)) == 0)
       return -1;
+    break;
+  default:
+    return -1;
+  }
+  if(ofile[act.fd])
+    fileclose(ofile[act.fd]);
+  ofile[act.fd] = f;
+  return 0;
+}
+
+int
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG], *buf;
+  struct fdtable *fdt;
+  uint uacts, op;
+  int i, pid;
+
+  if(argstr(0, path, sizeof(path)) < 0 || argint(2, (int*)&uacts) < 0 ||
+     (buf = kalloc()) == 0)
+    return -1;
+  fdt = 0;
+  pid = -1;
+  if(argargv(1, argv, buf) < 0)
+    goto out;
+  // The child's file table, private until spawn() gives it away.
+  if((fdt = fdtcopy(myproc()->fdt)) == 0)
+    goto out;
+  for(i = 0; uacts; i++){
+    if(fetchint(uacts + i*sizeof(struct spawnact), (int*)&op) < 0)
+      goto out;
+    if(op == 0)
+      break;
+    if(i == NSPAWNACT || applyact(uacts + i*sizeof(struct spawnact), fdt->ofile) < 0)
+      goto out;
   }
-  return exec(path, argv);
+  pid = spawn(path, argv, fdt);
+
+ out:
+  if(pid < 0 && fdt)
+    fdtrelease(fdt);
+  kfree(buf);
+  return pid;
 }
 
 int
@@ -426,14 +544,14 @@ sys_pipe(void)
   struct file *rf, *wf;
   int fd0, fd1;
 
-  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
+  if(argptrw(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
     return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      myproc()->ofile[fd0] = 0;
+      myproc()->fdt->ofile[fd0] = 0;
     fileclose(rf);
     fileclose(wf);
     return -1;
@@ -442,3 +560,76 @@ sys_pipe(void)
   fd[1] = fd1;
   return 0;
 }
+
+// Map len bytes of the file open as fd, starting at the page-aligned
+// offset off.  Pages are read in on first access.  With MAP_SHARED,
+// every mapping of a file page shares one physical page, and stores
+// reach the file when the mapping goes away; with MAP_PRIVATE, the
+// mapping gets its own copy.  Returns the mapping's address.
+int
+sys_mmap(void)
+{
+  struct proc *curproc = myproc();
+  struct file *f;
+  struct vma *v;
+  int off, len, prot, flags, locked;
+  uint va;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &off) < 0 || argint(2, &len) < 0 ||
+     argint(3, &prot) < 0 || argint(4, &flags) < 0)
+    return -1;
+  if(f->type != FD_INODE || off < 0 || off % PGSIZE != 0 || len <= 0)
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  // Writes to a shared mapping go to the file.
+  if(!f->readable || (flags == MAP_SHARED && (prot & PROT_WRITE) && !f->writable))
+    return -1;
+  // Nor to a program that is running (see writei()).
+  if(flags == MAP_SHARED && (prot & PROT_WRITE) && f->ip->ntext > 0)
+    return -1;
+  locked = vmbegin();
+  if((v = vmaalloc(curproc)) == 0 || (va = vmaspace(curproc, len)) == 0){
+    vmend(locked);
+    return -1;
+  }
+  ilock(f->ip);
+  v->filesz = f->ip->size > off ? f->ip->size - off : 0;
+  iunlock(f->ip);
+  v->type = VMA_FILE;
+  v->start = va;
+  v->end = va + PGROUNDUP(len);
+  v->ip = idup(f->ip);
+  v->off = off;
+  v->writable = (prot & PROT_WRITE) != 0;
+  v->shared = flags == MAP_SHARED;
+  vmend(locked);
+  return va;
+}
+
+// Remove the mapping at addr, writing back its dirty shared pages.
+// Only whole mappings can be removed.
+int
+sys_munmap(void)
+{
+  struct proc *curproc = myproc();
+  struct vma *v;
+  int addr, len, locked;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  locked = vmbegin();
+  for(v = curproc->vm->vma; v < &curproc->vm->vma[NVMA]; v++){
+    if(v->type == VMA_FILE && v->start == addr && v->start >= curproc->vm->sz){
+      if(PGROUNDUP(len) != v->end - v->start)
+        break;
+      vmaunmap(curproc->pgdir, v);
+      lcr3(V2P(curproc->pgdir));
+      vmaclose(v);
+      vmend(locked);
+      return 0;
+    }
+  }
+  vmend(locked);
+  return -1;
+}
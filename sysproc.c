@@ -6,6 +6,10 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "vmspace.h"
+#include "kstat.h"
 
 int
 sys_fork(void)
@@ -13,6 +17,57 @@ sys_fork(void)
   return fork();
 }
 
+int
+sys_vfork(void)
+{
+  return vfork();
+}
+
+int
+sys_clone(void)
+{
+  int fn, arg;
+  char *stack;
+
+  if(argint(0, &fn) < 0 || argint(1, &arg) < 0 ||
+     argptrw(2, &stack, PGSIZE) < 0)
+    return -1;
+  return clone(fn, arg, (uint)stack);
+}
+
+int
+sys_join(void)
+{
+  uint *ustack, stack;
+  int pid;
+
+  if(argptrw(0, (void*)&ustack, sizeof(*ustack)) < 0)
+    return -1;
+  if((pid = join(&stack)) >= 0)
+    *ustack = stack;
+  return pid;
+}
+
+int
+sys_futex_wait(void)
+{
+  int addr, val;
+
+  if(argint(0, &addr) < 0 || argint(1, &val) < 0)
+    return -1;
+  return futexwait(addr, val);
+}
+
+int
+sys_futex_wake(void)
+{
+  int addr, n;
+
+  if(argint(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return futexwake(addr, n);
+}
+
 int
 sys_exit(void)
 {
@@ -45,36 +100,21 @@ sys_getpid(void)
 int
 sys_sbrk(void)
 {
-  int addr;
   int n;
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
-    return -1;
-  return addr;
+  return growproc(n);
 }
 
 int
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   if(argint(0, &n) < 0)
     return -1;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(myproc()->killed){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return sleepticks(n);
 }
 
 // return how many clock tick interrupts have occurred
@@ -82,12 +122,19 @@ sys_sleep(void)
 int
 sys_uptime(void)
 {
-  uint xticks;
+  return ticks;
+}
+
+// Store the number of nanoseconds since boot in *ns.
+int
+sys_clockns(void)
+{
+  uint64 *ns;
 
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+  if(argptrw(0, (void*)&ns, sizeof(*ns)) < 0)
+    return -1;
+  *ns = nsclock();
+  return 0;
 }
 
 int
@@ -95,9 +142,9 @@ sys_waitx (void)
 {
   int *wtime;
   int *rtime;
-  if(argptr(0,(void*)&wtime,sizeof(int*)) < 0)
+  if(argptrw(0,(void*)&wtime,sizeof(int*)) < 0)
     return -1;
-  if(argptr(1,(void*)&rtime, sizeof(int*)) < 0)
+  if(argptrw(1,(void*)&rtime, sizeof(int*)) < 0)
     return -1;
   return waitx(wtime, rtime);
 }
@@ -117,4 +164,123 @@ void
 sys_proc_info(void)
 {
   return proc_info();
-}
\ No newline at end of file
+}
+
+// Map the shared memory segment called name, creating it with
+// size bytes if it does not exist.  Returns its address.
+int
+sys_shm_open(void)
+{
+  struct proc *curproc = myproc();
+  struct vma *v;
+  char name[MAXPATH];
+  int size, id, locked;
+  uint va;
+
+  if(argstr(0, name, sizeof(name)) < 0 || argint(1, &size) < 0 || size <= 0)
+    return -1;
+  locked = vmbegin();
+  if((v = vmaalloc(curproc)) == 0 || (id = shmget(name, size)) < 0){
+    vmend(locked);
+    return -1;
+  }
+  size = shmsize(id);
+  if((va = vmaspace(curproc, size)) == 0 || shmmap(curproc->pgdir, id, va) < 0){
+    shmrelease(id);
+    vmend(locked);
+    return -1;
+  }
+  v->type = VMA_SHM;
+  v->start = va;
+  v->end = va + size;
+  v->shmid = id;
+  v->writable = 1;
+  vmend(locked);
+  return va;
+}
+
+// Unmap the shared memory segment mapped at addr.
+int
+sys_shm_close(void)
+{
+  struct proc *curproc = myproc();
+  struct vma *v;
+  int addr, locked;
+
+  if(argint(0, &addr) < 0)
+    return -1;
+  locked = vmbegin();
+  for(v = curproc->vm->vma; v < &curproc->vm->vma[NVMA]; v++){
+    if(v->type == VMA_SHM && v->start == addr){
+      vmaunmap(curproc->pgdir, v);
+      lcr3(V2P(curproc->pgdir));
+      vmaclose(v);
+      vmend(locked);
+      return 0;
+    }
+  }
+  vmend(locked);
+  return -1;
+}
+
+// Print kernel memory allocator statistics on the console.
+int
+sys_mem_info(void)
+{
+  kallocinfo();
+  slabinfo();
+  shminfo();
+  swapinfo();
+  ksminfo();
+  imginfo();
+  reclaiminfo();
+  return 0;
+}
+
+// Kernel event counters.  Each CPU counts in cache lines of its
+// own, without atomic instructions, and kstatget() adds the CPUs'
+// counts up, so counting never moves a line between CPUs.
+static struct {
+  uint n[NKSTAT];
+} __attribute__((aligned(CACHELINE))) kstats[NCPU];
+
+// Count one occurrence of kernel event id.
+void
+kstatinc(int id)
+{
+  kstatadd(id, 1);
+}
+
+void
+kstatadd(int id, uint n)
+{
+  pushcli();
+  kstats[cpuid()].n[id] += n;
+  popcli();
+}
+
+// Return the current value of kernel counter id.
+uint
+kstatget(int id)
+{
+  uint n;
+  int i;
+
+  n = 0;
+  for(i = 0; i < NCPU; i++)
+    n += kstats[i].n[id];
+  return n;
+}
+
+// Return the current value of kernel counter id (see kstat.h).
+int
+sys_kstat(void)
+{
+  int id;
+
+  if(argint(0, &id) < 0 || id < 0 || id >= NKSTAT)
+    return -1;
+  if(id == KSTAT_FREEPG)
+    return kfreepages();
+  return kstatget(id);
+}
@@ -0,0 +1,151 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// User-level threads on clone() and join().  Each thread runs on a
+// one-page stack from malloc(); the thread's function and argument
+// sit at the bottom of it, below anything the thread pushes.
+//
+// struct lock spins.  struct mutex and struct cond sleep in the
+// kernel with futex_wait(), but only when they have to: taking a
+// free mutex or releasing one nobody waits for is a single atomic
+// instruction.
+
+#define TSTACK 4096   // must be PGSIZE, the size clone() expects
+
+struct tstart {
+  void (*fn)(void*);
+  void *arg;
+};
+
+static void
+tstart(void *a)
+{
+  struct tstart *t = a;
+
+  t->fn(t->arg);
+  exit();
+}
+
+// Start fn(arg) in a new thread.  Returns its pid, or -1.
+int
+thread_create(void (*fn)(void*), void *arg)
+{
+  struct tstart *t;
+  char *stack;
+  int pid;
+
+  if((stack = malloc(TSTACK)) == 0)
+    return -1;
+  t = (struct tstart*)stack;
+  t->fn = fn;
+  t->arg = arg;
+  if((pid = clone(tstart, t, stack)) < 0)
+    free(stack);
+  return pid;
+}
+
+// Wait for one of this thread's threads to finish.
+// Returns its pid, or -1 if there are none.
+int
+thread_join(void)
+{
+  void *stack;
+  int pid;
+
+  if((pid = join(&stack)) >= 0)
+    free(stack);
+  return pid;
+}
+
+void
+lock_init(struct lock *lk)
+{
+  lk->locked = 0;
+}
+
+// Spin until lk is free.
+void
+lock_acquire(struct lock *lk)
+{
+  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
+    ;
+}
+
+void
+lock_release(struct lock *lk)
+{
+  __sync_lock_release(&lk->locked);
+}
+
+// Mutex states.
+#define UNLOCKED  0
+#define LOCKED    1
+#define CONTENDED 2   // locked, and there may be waiters
+
+void
+mutex_init(struct mutex *m)
+{
+  m->state = UNLOCKED;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  uint c;
+
+  if((c = __sync_val_compare_and_swap(&m->state, UNLOCKED, LOCKED)) == UNLOCKED)
+    return;
+  // Mark the mutex contended so that its holder wakes us, and sleep
+  // until it is released.  Once a waiter has been here the mutex
+  // stays CONTENDED until it is unlocked with no one left waiting.
+  if(c != CONTENDED)
+    c = __sync_lock_test_and_set(&m->state, CONTENDED);
+  while(c != UNLOCKED){
+    futex_wait(&m->state, CONTENDED);
+    c = __sync_lock_test_and_set(&m->state, CONTENDED);
+  }
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__sync_fetch_and_sub(&m->state, 1) != LOCKED){
+    m->state = UNLOCKED;
+    futex_wake(&m->state, 1);
+  }
+}
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+}
+
+// Release m, sleep until signalled, and take m again.
+// As with any condition variable, the caller must recheck its
+// condition: a wakeup may be spurious.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  uint seq;
+
+  seq = c->seq;
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq);
+  mutex_lock(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 0x7fffffff);
+}
@@ -0,0 +1,84 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Parallel speedup of clone() threads.  A fixed amount of integer
+// work is split into equal slices over 1, 2, ... up to MAX threads
+// (argv[1], default 4); each thread sums its slice into its own
+// slot of a shared array.  Run with as many CPUs as threads, e.g.
+// make qemu CPUS=4, to see the work spread across them.
+
+#define WORK   (1 << 24)      // inner loop iterations in total
+#define MAXTHR 16
+
+struct slice {
+  uint start;
+  uint n;
+  uint sum;
+  char pad[52];               // one slice per cache line
+};
+
+struct slice slices[MAXTHR];
+
+void
+worker(void *arg)
+{
+  struct slice *s = arg;
+  uint i, x;
+
+  x = 0;
+  for(i = s->start; i < s->start + s->n; i++)
+    x += (i * 2654435761u) >> 7;
+  s->sum = x;
+}
+
+// Time the work on nthr threads.  Returns microseconds.
+uint
+run(int nthr, uint *sum)
+{
+  uint64 t0, t1;
+  int i;
+
+  for(i = 0; i < nthr; i++){
+    slices[i].start = i * (WORK / nthr);
+    slices[i].n = WORK / nthr;
+  }
+  clockns(&t0);
+  for(i = 1; i < nthr; i++){
+    if(thread_create(worker, &slices[i]) < 0){
+      printf(1, "threadbench: thread_create failed\n");
+      exit();
+    }
+  }
+  worker(&slices[0]);
+  for(i = 1; i < nthr; i++)
+    thread_join();
+  clockns(&t1);
+  *sum = 0;
+  for(i = 0; i < nthr; i++)
+    *sum += slices[i].sum;
+  return nsdiv(t1 - t0, 1000);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int max, n;
+  uint us, us1, sum, sum1;
+
+  max = argc > 1 ? atoi(argv[1]) : 4;
+  if(max < 1 || max > MAXTHR){
+    printf(2, "usage: threadbench [threads <= %d]\n", MAXTHR);
+    exit();
+  }
+  us1 = run(1, &sum1);
+  printf(1, "1 thread: %d us\n", us1);
+  for(n = 2; n <= max; n++){
+    us = run(n, &sum);
+    if(sum != sum1)
+      printf(1, "threadbench: %d threads got a different sum\n", n);
+    printf(1, "%d threads: %d us, speedup %d.%d%dx\n", n, us,
+           us1 / us, us1 * 10 / us % 10, us1 * 100 / us % 10);
+  }
+  exit();
+}
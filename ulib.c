@@ -104,3 +104,26 @@ memmove(void *vdst, const void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+// n / d for a 64-bit n, truncated to 32 bits.  Used to turn
+// clockns() intervals into microseconds or milliseconds without
+// needing libgcc's 64-bit division.
+uint
+nsdiv(uint64 n, uint d)
+{
+  uint64 r;
+  uint q;
+  int i;
+
+  q = r = 0;
+  for(i = 63; i >= 0; i--){
+    r = (r << 1) | ((n >> i) & 1);
+    if(r >= d){
+      r -= d;
+      if(i >= 32)
+        return 0xFFFFFFFF;  // quotient does not fit; saturate
+      q |= 1u << i;
+    }
+  }
+  return q;
+}
@@ -3,8 +3,24 @@
 #include "user.h"
 #include "param.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator.
+//
+// Small requests (up to the largest size class, 2KB with the header)
+// are served from per-class free lists: malloc() pops the head of
+// its class's list and free() pushes the block back, both in
+// constant time.  An empty list is refilled by carving a chunk from
+// the large-block allocator into blocks of the class; small blocks
+// are never merged or given back.
+//
+// Larger requests use the first-fit free list of Kernighan and
+// Ritchie, The C Programming Language, 2nd ed., Section 8.7, which
+// merges adjacent free blocks.  When the free block at the top of
+// the heap grows past TRIM bytes, the heap is shrunk with a negative
+// sbrk() so the memory goes back to the kernel.
+//
+// Every block starts with a Header.  A free large block uses both
+// fields; an allocated block keeps its size in units, or SMALL and
+// its class; a free small block links its class list through ptr.
 
 typedef long Align;
 
@@ -18,13 +34,28 @@ union header {
 
 typedef union header Header;
 
+#define SMALL    0x80000000         // size of a small block: SMALL|class
+#define MORECORE 4096               // fewest units to ask sbrk() for
+#define TRIM     (128*1024)         // shrink the heap past this much free at the top
+#define KEEP     (32*1024)          // free bytes left at the top after trimming
+
+// Block sizes of the small classes, header included.
+static uint classsize[] = {
+  16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048
+};
+#define NCLASS (sizeof(classsize)/sizeof(classsize[0]))
+
 static Header base;
 static Header *freep;
+static Header *classfree[NCLASS];
+static struct mutex mlock;  // threads share the heap
 
-void
-free(void *ap)
+// Put the block at ap on the large free list, merging it with its
+// neighbours.  Returns the free block it ended up in.
+static Header*
+linkblock(void *ap)
 {
-  Header *bp, *p;
+  Header *bp, *p, *top;
 
   bp = (Header*)ap - 1;
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
@@ -38,9 +69,31 @@ free(void *ap)
   if(p + p->s.size == bp){
     p->s.size += bp->s.size;
     p->s.ptr = bp->s.ptr;
-  } else
+    top = p;
+  } else {
     p->s.ptr = bp;
+    top = bp;
+  }
   freep = p;
+  return top;
+}
+
+// Free a large block.  If that leaves a large free block at the top
+// of the heap, give most of it back, unless someone else has moved
+// the break past it.
+static void
+freeblock(void *ap)
+{
+  Header *top;
+  uint n;
+
+  top = linkblock(ap);
+  if(top->s.size * sizeof(Header) > TRIM &&
+     (char*)(top + top->s.size) == sbrk(0)){
+    n = top->s.size - KEEP/sizeof(Header);
+    if(sbrk(-(int)(n * sizeof(Header))) != (char*)-1)
+      top->s.size -= n;
+  }
 }
 
 static Header*
@@ -49,19 +102,21 @@ morecore(uint nu)
   char *p;
   Header *hp;
 
-  if(nu < 4096)
-    nu = 4096;
+  if(nu < MORECORE)
+    nu = MORECORE;
   p = sbrk(nu * sizeof(Header));
   if(p == (char*)-1)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  // Not freeblock(): the chunk must not be trimmed away before it
+  // is used.
+  linkblock((void*)(hp + 1));
   return freep;
 }
 
-void*
-malloc(uint nbytes)
+static void*
+allocblock(uint nbytes)
 {
   Header *p, *prevp;
   uint nunits;
@@ -88,3 +143,127 @@ malloc(uint nbytes)
         return 0;
   }
 }
+
+// The smallest class whose blocks hold nbytes, or -1.
+static int
+sizeclass(uint nbytes)
+{
+  int c;
+
+  for(c = 0; c < NCLASS; c++)
+    if(nbytes <= classsize[c] - sizeof(Header))
+      return c;
+  return -1;
+}
+
+// Fill the empty list of class c from a large block.
+static int
+refill(int c)
+{
+  char *chunk;
+  Header *h;
+  uint i, n;
+
+  n = 4096 / classsize[c];
+  if(n < 4)
+    n = 4;
+  if((chunk = allocblock(n * classsize[c] - sizeof(Header))) == 0)
+    return -1;
+  // The chunk's own header stays in front of it; use the space
+  // from there on, which is all that was asked for.
+  chunk -= sizeof(Header);
+  for(i = 0; i < n; i++){
+    h = (Header*)(chunk + i*classsize[c]);
+    h->s.ptr = classfree[c];
+    classfree[c] = h;
+  }
+  return 0;
+}
+
+// Usable bytes in the allocated block at ap.
+static uint
+blocksize(void *ap)
+{
+  Header *bp = (Header*)ap - 1;
+
+  if(bp->s.size & SMALL)
+    return classsize[bp->s.size & ~SMALL] - sizeof(Header);
+  return (bp->s.size - 1) * sizeof(Header);
+}
+
+void
+free(void *ap)
+{
+  Header *bp;
+  int c;
+
+  if(ap == 0)
+    return;
+  bp = (Header*)ap - 1;
+  mutex_lock(&mlock);
+  if(bp->s.size & SMALL){
+    c = bp->s.size & ~SMALL;
+    bp->s.ptr = classfree[c];
+    classfree[c] = bp;
+  } else
+    freeblock(ap);
+  mutex_unlock(&mlock);
+}
+
+void*
+malloc(uint nbytes)
+{
+  Header *h;
+  void *p;
+  int c;
+
+  mutex_lock(&mlock);
+  if((c = sizeclass(nbytes)) < 0)
+    p = allocblock(nbytes);
+  else if(classfree[c] == 0 && refill(c) < 0)
+    p = 0;
+  else {
+    h = classfree[c];
+    classfree[c] = h->s.ptr;
+    h->s.size = SMALL | c;
+    p = h + 1;
+  }
+  mutex_unlock(&mlock);
+  return p;
+}
+
+void*
+calloc(uint n, uint size)
+{
+  void *p;
+
+  if(size && n > 0xffffffff / size)
+    return 0;
+  if((p = malloc(n * size)) != 0)
+    memset(p, 0, n * size);
+  return p;
+}
+
+// Resize the block at ap to nbytes, moving it if it does not fit.
+// realloc(0, n) is malloc(n) and realloc(ap, 0) frees ap.
+void*
+realloc(void *ap, uint nbytes)
+{
+  void *p;
+  uint n;
+
+  if(ap == 0)
+    return malloc(nbytes);
+  if(nbytes == 0){
+    free(ap);
+    return 0;
+  }
+  n = blocksize(ap);
+  if(nbytes <= n)
+    return ap;
+  if((p = malloc(nbytes)) == 0)
+    return 0;
+  memmove(p, ap, n);
+  free(ap);
+  return p;
+}
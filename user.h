@@ -1,5 +1,6 @@
 struct stat;
 struct rtcdate;
+struct spawnact;
 
 // system calls
 int fork(void);
@@ -26,6 +27,19 @@ int uptime(void);
 int waitx(int* , int* );
 int set_priority(int, int);
 void proc_info(void);
+int kstat(int);
+int clockns(uint64*);
+void mem_info(void);
+char* shm_open(char*, int);
+int shm_close(char*);
+char* mmap(int, int, int, int, int);
+int munmap(char*, int);
+int vfork(void);
+int spawn(char*, char**, struct spawnact*);
+int clone(void(*)(void*), void*, void*);
+int join(void**);
+int futex_wait(volatile uint*, uint);
+int futex_wake(volatile uint*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -38,5 +52,31 @@ char* gets(char*, int max);
 uint strlen(const char*);
 void* memset(void*, int, uint);
 void* malloc(uint);
+void* calloc(uint, uint);
+void* realloc(void*, uint);
 void free(void*);
 int atoi(const char*);
+uint nsdiv(uint64, uint);
+
+// thread.c
+struct lock {
+  volatile uint locked;
+};
+int thread_create(void(*)(void*), void*);
+int thread_join(void);
+void lock_init(struct lock*);
+void lock_acquire(struct lock*);
+void lock_release(struct lock*);
+struct mutex {
+  volatile uint state;
+};
+struct cond {
+  volatile uint seq;
+};
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
@@ -7,6 +7,7 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "spawn.h"
 
 char buf[8192];
 char name[3];
@@ -1374,8 +1375,8 @@ iref(void)
 }
 
 // test that fork fails gracefully
-// the forktest binary also does this, but it runs out of proc entries first.
-// inside the bigger usertests binary, we run out of memory first.
+// the forktest binary also does this.  both run out of proc entries
+// (NPROC) unless memory runs out first.
 void
 forktest(void)
 {
@@ -1383,7 +1384,7 @@ forktest(void)
 
   printf(1, "fork test\n");
 
-  for(n=0; n<1000; n++){
+  for(n=0; n<NPROC; n++){
     pid = fork();
     if(pid < 0)
       break;
@@ -1391,8 +1392,8 @@ forktest(void)
       exit();
   }
 
-  if(n == 1000){
-    printf(1, "fork claimed to work 1000 times!\n");
+  if(n == NPROC){
+    printf(1, "fork claimed to work %d times!\n", NPROC);
     exit();
   }
 
@@ -1411,6 +1412,674 @@ forktest(void)
   printf(1, "fork test OK\n");
 }
 
+// after fork, do parent and child each see only their own writes,
+// including writes the kernel makes on their behalf (read())?
+void
+cowtest(void)
+{
+  enum { N = 8 };
+  char *a;
+  int i, pid, fds[2];
+
+  printf(1, "cow test\n");
+  a = sbrk(N*4096);
+  for(i = 0; i < N; i++)
+    a[i*4096] = 'p';
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    for(i = 0; i < N; i++){
+      if(a[i*4096] != 'p'){
+        printf(1, "cow test: child sees wrong data\n");
+        exit();
+      }
+      a[i*4096] = 'c';
+    }
+    write(fds[1], "k", 1);
+    exit();
+  }
+  // The kernel writes into a page that is still shared.
+  if(read(fds[0], a + 3*4096, 1) != 1 || a[3*4096] != 'k'){
+    printf(1, "cow test: read into shared page failed\n");
+    exit();
+  }
+  wait();
+  for(i = 0; i < N; i++){
+    if(i != 3 && a[i*4096] != 'p'){
+      printf(1, "cow test: child write visible in parent\n");
+      exit();
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+  sbrk(-N*4096);
+  printf(1, "cow test OK\n");
+}
+
+// sbrk() only reserves address space; pages appear, zeroed, when
+// touched, including when the kernel is the one touching them.
+void
+lazytest(void)
+{
+  enum { SZ = 64*1024*1024 };
+  char *a;
+  int i, pid, fd;
+
+  printf(1, "lazy sbrk test\n");
+  a = sbrk(SZ);
+  if(a == (char*)-1){
+    printf(1, "lazy sbrk test: sbrk failed\n");
+    exit();
+  }
+  // Far more than physical memory, so it only works if
+  // untouched pages cost nothing.
+  for(i = 0; i < SZ; i += SZ/16){
+    if(a[i] != 0){
+      printf(1, "lazy sbrk test: page not zero\n");
+      exit();
+    }
+    a[i] = 'x';
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(a[SZ/2] != 'x' || a[SZ/2 + 4096] != 0){
+      printf(1, "lazy sbrk test: child sees wrong data\n");
+      exit();
+    }
+    exit();
+  }
+  wait();
+  // read() into a page that has never been touched.
+  fd = open("README", 0);
+  if(fd < 0){
+    printf(1, "open README failed\n");
+    exit();
+  }
+  if(read(fd, a + SZ - 100, 100) != 100){
+    printf(1, "lazy sbrk test: read into lazy page failed\n");
+    exit();
+  }
+  close(fd);
+  sbrk(-SZ);
+  printf(1, "lazy sbrk test OK\n");
+}
+
+// Two processes see each other's writes to a shared memory
+// segment, and the segment goes away with its last mapping.
+void
+shmtest(void)
+{
+  char *a, *b;
+  int pid;
+
+  printf(1, "shm test\n");
+  a = shm_open("shmtest", 8192);
+  if(a == (char*)-1){
+    printf(1, "shm_open failed\n");
+    exit();
+  }
+  if(a[0] != 0 || a[8191] != 0){
+    printf(1, "shm test: new segment not zero\n");
+    exit();
+  }
+  a[0] = 'p';
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    b = shm_open("shmtest", 4096);
+    if(b == (char*)-1 || b == a || b[0] != 'p'){
+      printf(1, "shm test: second mapping wrong\n");
+      exit();
+    }
+    a[4096] = 'c';  // through the mapping inherited from fork
+    b[1] = 'c';
+    shm_close(b);
+    exit();
+  }
+  wait();
+  if(a[1] != 'c' || a[4096] != 'c'){
+    printf(1, "shm test: child writes not visible\n");
+    exit();
+  }
+  if(shm_close(a) != 0 || shm_close(a) != -1){
+    printf(1, "shm test: shm_close failed\n");
+    exit();
+  }
+  a = shm_open("shmtest", 4096);
+  if(a == (char*)-1 || a[0] != 0){
+    printf(1, "shm test: segment outlived its mappings\n");
+    exit();
+  }
+  shm_close(a);
+  printf(1, "shm test OK\n");
+}
+
+// Private mappings copy the file; shared mappings write their
+// stores back to it, and processes mapping the same file page see
+// each other's stores.
+void
+mmaptest(void)
+{
+  char buf[16], *a, *b;
+  int fd, i, pid;
+
+  printf(1, "mmap test\n");
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "mmap test: create failed\n");
+    exit();
+  }
+  for(i = 0; i < 2*4096; i += sizeof(buf)){
+    memset(buf, 'a' + i / 4096, sizeof(buf));
+    write(fd, buf, sizeof(buf));
+  }
+  if(mmap(fd, 1, 4096, PROT_READ, MAP_PRIVATE) != (char*)-1 ||
+     mmap(fd, 0, 4096, PROT_READ, 0) != (char*)-1){
+    printf(1, "mmap test: bad arguments accepted\n");
+    exit();
+  }
+
+  a = mmap(fd, 0, 3*4096, PROT_READ|PROT_WRITE, MAP_PRIVATE);
+  if(a == (char*)-1 || a[0] != 'a' || a[4096] != 'b' || a[2*4096] != 0){
+    printf(1, "mmap test: private mapping wrong\n");
+    exit();
+  }
+  a[0] = 'x';
+  if(munmap(a, 4096) != -1 || munmap(a, 3*4096) != 0){
+    printf(1, "mmap test: munmap failed\n");
+    exit();
+  }
+
+  a = mmap(fd, 4096, 4096, PROT_READ|PROT_WRITE, MAP_SHARED);
+  if(a == (char*)-1 || a[0] != 'b'){
+    printf(1, "mmap test: shared mapping wrong\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    b = mmap(fd, 4096, 4096, PROT_READ|PROT_WRITE, MAP_SHARED);
+    if(b == (char*)-1 || b == a){
+      printf(1, "mmap test: second mapping failed\n");
+      exit();
+    }
+    b[1] = 'c';
+    a[2] = 'c';  // through the mapping inherited from fork
+    exit();
+  }
+  wait();
+  if(a[1] != 'c' || a[2] != 'c'){
+    printf(1, "mmap test: child stores not visible\n");
+    exit();
+  }
+  a[4095] = 'd';
+  munmap(a, 4096);
+
+  close(fd);
+
+  fd = open("mmapfile", O_RDONLY);
+  if(read(fd, buf, 2) != 2 || buf[0] != 'a'){
+    printf(1, "mmap test: private store reached the file\n");
+    exit();
+  }
+  if(mmap(fd, 0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED) != (char*)-1){
+    printf(1, "mmap test: writable mapping of read-only file\n");
+    exit();
+  }
+  a = mmap(fd, 4096, 4096, PROT_READ, MAP_PRIVATE);
+  if(a == (char*)-1 || a[1] != 'c' || a[2] != 'c' || a[4095] != 'd'){
+    printf(1, "mmap test: shared stores not written back\n");
+    exit();
+  }
+  if(read(fd, a, 1) != -1){
+    printf(1, "mmap test: read into read-only mapping\n");
+    exit();
+  }
+  munmap(a, 4096);
+  close(fd);
+  unlink("mmapfile");
+  printf(1, "mmap test OK\n");
+}
+
+// Two processes touch 8MB each and check that every page keeps
+// its contents.  On a 16MB machine (make qemu MEM=16) that is more
+// memory than there is, so pages go through swap.
+#define SWAPTESTSZ (8*1024*1024)
+
+void
+swaptest(void)
+{
+  char *a;
+  int i, pid, round;
+
+  printf(1, "swap test\n");
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  a = sbrk(SWAPTESTSZ);
+  if(a == (char*)-1){
+    printf(1, "swap test: sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < SWAPTESTSZ; i += 4096)
+    *(int*)(a + i) = i ^ getpid();
+  for(round = 0; round < 2; round++){
+    for(i = 0; i < SWAPTESTSZ; i += 4096){
+      if(*(int*)(a + i) != (i ^ getpid())){
+        printf(1, "swap test: page %d lost its contents\n", i / 4096);
+        exit();
+      }
+    }
+  }
+  if(pid == 0)
+    exit();
+  wait();
+  sbrk(-SWAPTESTSZ);
+  printf(1, "swap test OK\n");
+}
+
+// spawn() with file actions: echo's output goes to a pipe.
+void
+spawntest(void)
+{
+  char *echoargv[] = { "echo", "spawned", 0 };
+  struct spawnact act[4];
+  char buf[16];
+  int fds[2], n, tot;
+
+  printf(1, "spawn test\n");
+  if(spawn("nonexistent", echoargv, 0) >= 0){
+    printf(1, "spawn test: spawned a nonexistent program\n");
+    exit();
+  }
+  if(pipe(fds) < 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  act[0].op = SPAWN_DUP2;
+  act[0].fd = 1;
+  act[0].arg = fds[1];
+  act[1].op = SPAWN_CLOSE;
+  act[1].fd = fds[0];
+  act[2].op = SPAWN_CLOSE;
+  act[2].fd = fds[1];
+  act[3].op = 0;
+  if(spawn("echo", echoargv, act) < 0){
+    printf(1, "spawn test: spawn failed\n");
+    exit();
+  }
+  close(fds[1]);
+  tot = 0;
+  while((n = read(fds[0], buf + tot, sizeof(buf) - 1 - tot)) > 0)
+    tot += n;
+  close(fds[0]);
+  buf[tot] = 0;
+  if(wait() < 0 || strcmp(buf, "spawned\n") != 0){
+    printf(1, "spawn test: child wrote %s\n", buf);
+    exit();
+  }
+  printf(1, "spawn test OK\n");
+}
+
+// A vfork() child runs in its parent's memory, and the parent
+// waits for it to exit.
+int vforkval;
+
+void
+vforktest(void)
+{
+  int pid;
+
+  printf(1, "vfork test\n");
+  vforkval = 0;
+  pid = vfork();
+  if(pid < 0){
+    printf(1, "vfork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(sbrk(4096) != (char*)-1)
+      vforkval = -1;
+    else
+      vforkval = getpid();
+    exit();
+  }
+  if(vforkval != pid){
+    printf(1, "vfork test: parent saw %d, child was %d\n", vforkval, pid);
+    exit();
+  }
+  if(wait() != pid){
+    printf(1, "vfork test: wait failed\n");
+    exit();
+  }
+  printf(1, "vfork test OK\n");
+}
+
+// Threads share memory, the heap and open files, and join()
+// reaps them.
+#define NTHR   4
+#define NITER  1000
+
+struct lock thrlock;
+int thrcount;
+int thrfd;
+
+void
+thrinc(void *arg)
+{
+  int i;
+  char *p;
+
+  for(i = 0; i < NITER; i++){
+    lock_acquire(&thrlock);
+    thrcount++;
+    lock_release(&thrlock);
+  }
+  if((p = malloc(100)) == 0){
+    printf(1, "thread test: malloc failed\n");
+    exit();
+  }
+  free(p);
+  if(arg == 0)
+    thrfd = open("thrfile", O_CREATE|O_RDWR);
+}
+
+void
+threadtest(void)
+{
+  int i;
+
+  printf(1, "thread test\n");
+  lock_init(&thrlock);
+  thrcount = 0;
+  thrfd = -1;
+  for(i = 0; i < NTHR; i++){
+    if(thread_create(thrinc, (void*)i) < 0){
+      printf(1, "thread test: thread_create failed\n");
+      exit();
+    }
+  }
+  if(wait() != -1){
+    printf(1, "thread test: wait reaped a thread\n");
+    exit();
+  }
+  for(i = 0; i < NTHR; i++){
+    if(thread_join() < 0){
+      printf(1, "thread test: thread_join failed\n");
+      exit();
+    }
+  }
+  if(thread_join() != -1){
+    printf(1, "thread test: extra thread_join\n");
+    exit();
+  }
+  if(thrcount != NTHR*NITER){
+    printf(1, "thread test: count %d, want %d\n", thrcount, NTHR*NITER);
+    exit();
+  }
+  if(thrfd < 0 || write(thrfd, "x", 1) != 1){
+    printf(1, "thread test: file opened by a thread not shared\n");
+    exit();
+  }
+  close(thrfd);
+  unlink("thrfile");
+  printf(1, "thread test OK\n");
+}
+
+// The heap shrinks under threads that are using it: pages trimmed
+// while other threads run on other CPUs must come back zeroed when
+// the heap grows again, and the threads' own pages stay intact.
+#define NTRIM  200
+#define TRIMPG 16
+
+volatile int trimdone;
+char *trimbuf;
+
+void
+trimtouch(void *arg)
+{
+  volatile char *p;
+  int i, n;
+
+  p = trimbuf + (int)arg * 4096;
+  for(n = 0; !trimdone; n++){
+    for(i = 0; i < 4096; i += 64)
+      p[i] = n;
+    for(i = 0; i < 4096; i += 64){
+      if(p[i] != (char)n){
+        printf(1, "trim test: thread page changed under it\n");
+        exit();
+      }
+    }
+  }
+}
+
+void
+trimtest(void)
+{
+  char *p;
+  int i, j;
+
+  printf(1, "trim test\n");
+  trimdone = 0;
+  trimbuf = sbrk(2*4096);
+  for(i = 0; i < 2; i++){
+    if(thread_create(trimtouch, (void*)i) < 0){
+      printf(1, "trim test: thread_create failed\n");
+      exit();
+    }
+  }
+  for(i = 0; i < NTRIM; i++){
+    p = sbrk(TRIMPG*4096);
+    for(j = 0; j < TRIMPG*4096; j += 4096){
+      if(p[j] != 0){
+        printf(1, "trim test: new heap page not zeroed\n");
+        exit();
+      }
+      p[j] = 1;
+    }
+    sbrk(-TRIMPG*4096);
+  }
+  trimdone = 1;
+  for(i = 0; i < 2; i++)
+    thread_join();
+  sbrk(-2*4096);
+  printf(1, "trim test OK\n");
+}
+
+// futex_wait() refuses to sleep on a changed word, and a mutex
+// and condition variable built on futexes keep threads in step.
+struct mutex fmutex;
+struct cond fcond;
+int fcount, fready;
+
+void
+futexinc(void *arg)
+{
+  int i;
+
+  for(i = 0; i < NITER; i++){
+    mutex_lock(&fmutex);
+    fcount++;
+    mutex_unlock(&fmutex);
+  }
+  mutex_lock(&fmutex);
+  while(!fready)
+    cond_wait(&fcond, &fmutex);
+  fcount++;
+  mutex_unlock(&fmutex);
+}
+
+void
+futextest(void)
+{
+  volatile uint word;
+  int i;
+
+  printf(1, "futex test\n");
+  word = 1;
+  if(futex_wait(&word, 0) != -1){
+    printf(1, "futex test: futex_wait slept on a changed word\n");
+    exit();
+  }
+  if(futex_wake(&word, 1) != 0){
+    printf(1, "futex test: futex_wake woke a waiter from nowhere\n");
+    exit();
+  }
+  mutex_init(&fmutex);
+  cond_init(&fcond);
+  fcount = fready = 0;
+  for(i = 0; i < NTHR; i++){
+    if(thread_create(futexinc, 0) < 0){
+      printf(1, "futex test: thread_create failed\n");
+      exit();
+    }
+  }
+  sleep(5);
+  mutex_lock(&fmutex);
+  fready = 1;
+  cond_broadcast(&fcond);
+  mutex_unlock(&fmutex);
+  for(i = 0; i < NTHR; i++)
+    thread_join();
+  if(fcount != NTHR*NITER + NTHR){
+    printf(1, "futex test: count %d, want %d\n", fcount, NTHR*NITER + NTHR);
+    exit();
+  }
+  printf(1, "futex test OK\n");
+}
+
+// realloc() keeps the contents, calloc() zeroes, and freeing a
+// lot of memory at the top of the heap shrinks it.
+void
+malloctest(void)
+{
+  char *p, *q, *top, *big[16];
+  int i;
+
+  printf(1, "malloc test\n");
+  free(0);
+  p = malloc(10);
+  for(i = 0; i < 10; i++)
+    p[i] = i;
+  for(i = 100; i <= 20000; i += 4000){
+    if((q = realloc(p, i)) == 0){
+      printf(1, "malloc test: realloc failed\n");
+      exit();
+    }
+    p = q;
+  }
+  for(i = 0; i < 10; i++){
+    if(p[i] != i){
+      printf(1, "malloc test: realloc lost data\n");
+      exit();
+    }
+  }
+  free(p);
+  p = calloc(100, 100);
+  for(i = 0; i < 100*100; i++){
+    if(p[i] != 0){
+      printf(1, "malloc test: calloc not zeroed\n");
+      exit();
+    }
+  }
+  free(p);
+  for(i = 0; i < 16; i++)
+    big[i] = malloc(64*1024);
+  top = sbrk(0);
+  for(i = 15; i >= 0; i--)
+    free(big[i]);
+  if(sbrk(0) >= top){
+    printf(1, "malloc test: heap not returned\n");
+    exit();
+  }
+  printf(1, "malloc test OK\n");
+}
+
+// Blocks larger than the trim threshold can be allocated, freed
+// and allocated again.
+void
+bigmalloctest(void)
+{
+  static int sizes[] = { 256*1024, 1024*1024 };
+  char *p;
+  int i, j, k;
+
+  printf(1, "big malloc test\n");
+  for(i = 0; i < 2; i++){
+    for(k = 0; k < 2; k++){
+      if((p = malloc(sizes[i])) == 0){
+        printf(1, "big malloc test: malloc(%d) failed\n", sizes[i]);
+        exit();
+      }
+      for(j = 0; j < sizes[i]; j += 4096)
+        p[j] = j;
+      p[sizes[i] - 1] = 1;
+      free(p);
+    }
+  }
+  printf(1, "big malloc test OK\n");
+}
+
+// Pages the same-page merger may have merged while two processes
+// sleep with identical memory stay private when written.
+void
+ksmtest(void)
+{
+  char *p;
+  int i, pid;
+
+  printf(1, "ksm test\n");
+  p = sbrk(16*4096);
+  for(i = 0; i < 16*4096; i++)
+    p[i] = i / 4096;
+  pid = fork();
+  if(pid < 0){
+    printf(1, "ksm test: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    // Make the child's pages its own, identical again, then wait.
+    for(i = 0; i < 16*4096; i += 4096)
+      p[i] = 0x55;
+    for(i = 0; i < 16*4096; i += 4096)
+      p[i] = i / 4096;
+    sleep(100);
+    for(i = 0; i < 16*4096; i++)
+      p[i] = 0x77;
+    exit();
+  }
+  sleep(50);
+  wait();
+  for(i = 0; i < 16*4096; i++){
+    if(p[i] != i / 4096){
+      printf(1, "ksm test: page %d changed by another process\n", i / 4096);
+      exit();
+    }
+  }
+  sbrk(-16*4096);
+  printf(1, "ksm test OK\n");
+}
+
 void
 sbrktest(void)
 {
@@ -1768,6 +2437,18 @@ main(int argc, char *argv[])
   bigargtest();
   bsstest();
   sbrktest();
+  lazytest();
+  shmtest();
+  mmaptest();
+  swaptest();
+  spawntest();
+  vforktest();
+  threadtest();
+  trimtest();
+  futextest();
+  malloctest();
+  bigmalloctest();
+  ksmtest();
   validatetest();
 
   opentest();
@@ -1793,6 +2474,7 @@ main(int argc, char *argv[])
   dirfile();
   iref();
   forktest();
+  cowtest();
   bigdir(); // slow
 
   uio();
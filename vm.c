@@ -5,7 +5,13 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "vmspace.h"
 #include "elf.h"
+#include "kstat.h"
+
+#define NDEFER 32  // unmapped pages held per TLB shootdown
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
@@ -40,20 +46,39 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
 
   pde = &pgdir[PDX(va)];
   if(*pde & PTE_P){
+    if(*pde & PTE_PS)
+      panic("walkpgdir: 4MB page");
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
+    // Zeroed, so all those PTE_P bits are clear.
+    if(!alloc || (pgtab = (pte_t*)kzalloc()) == 0)
       return 0;
-    // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
-    // entries, if necessary.
-    *pde = V2P(pgtab) | PTE_P | PTE_W | PTE_U;
+    // entries, if necessary.  Another thread of the process may
+    // have installed a page table meanwhile (pagefault()).
+    if(!__sync_bool_compare_and_swap(pde, 0, V2P(pgtab) | PTE_P | PTE_W | PTE_U)){
+      kfree((char*)pgtab);
+      pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
+    }
   }
   return &pgtab[PTX(va)];
 }
 
+// Map the page at physical address pa at va in pgdir, unless
+// another thread of the process mapped something there first.
+// Returns 1 if it was mapped, 0 if the caller lost the race and
+// must drop its page, -1 if out of memory.
+static int
+setpte(pde_t *pgdir, uint va, uint pa, int perm)
+{
+  pte_t *pte;
+
+  if((pte = walkpgdir(pgdir, (char*)va, 1)) == 0)
+    return -1;
+  return __sync_bool_compare_and_swap(pte, 0, pa | perm | PTE_P);
+}
+
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
 // be page-aligned.
@@ -92,16 +117,22 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 //   KERNBASE..KERNBASE+EXTMEM: mapped to 0..EXTMEM (for I/O space)
 //   KERNBASE+EXTMEM..data: mapped to EXTMEM..V2P(data)
 //                for the kernel's instructions and r/o data
-//   data..KERNBASE+PHYSTOP: mapped to V2P(data)..PHYSTOP,
+//   data..KERNBASE+phystop: mapped to V2P(data)..phystop,
 //                                  rw data + free physical memory
 //   0xfe000000..0: mapped direct (devices such as ioapic)
 //
 // The kernel allocates physical memory for its heap and for user memory
-// between V2P(end) and the end of physical memory (PHYSTOP)
-// (directly addressable from end..P2V(PHYSTOP)).
+// between V2P(end) and the end of physical memory (phystop, found
+// by memdetect() at boot) (directly addressable from end..P2V(phystop)).
 
 // This table defines the kernel's mappings, which are present in
-// every process's page table.
+// every process's page table.  Wherever a region allows it they
+// are made of 4MB pages (PTE_PS), which need no page table page
+// and take a single TLB entry.  The mappings are built once, in
+// kpgdir; every other page directory copies kpgdir's kernel PDEs
+// and so shares its kernel page tables.  They are the same in every
+// address space, so they are global (PTE_G) and survive the TLB
+// flush of a %cr3 load.
 static struct kmap {
   void *virt;
   uint phys_start;
@@ -110,37 +141,71 @@ static struct kmap {
 } kmap[] = {
  { (void*)KERNBASE, 0,             EXTMEM,    PTE_W}, // I/O space
  { (void*)KERNLINK, V2P(KERNLINK), V2P(data), 0},     // kern text+rodata
- { (void*)data,     V2P(data),     PHYSTOP,   PTE_W}, // kern data+memory
+ { (void*)data,     V2P(data),     0,         PTE_W}, // kern data+memory (to phystop)
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
-// Set up kernel part of a page table.
+// Map the kmap[] region k into pgdir: 4MB pages where the
+// addresses are 4MB aligned and at least 4MB remain, 4KB pages
+// for the rest.
+static int
+mapkvm(pde_t *pgdir, struct kmap *k)
+{
+  char *va;
+  uint pa, size, n, perm;
+
+  va = k->virt;
+  pa = k->phys_start;
+  size = k->phys_end - k->phys_start;
+  perm = k->perm | PTE_G;
+  while(size > 0){
+    if((uint)va % LGPGSIZE == 0 && pa % LGPGSIZE == 0 && size >= LGPGSIZE){
+      pgdir[PDX(va)] = pa | perm | PTE_P | PTE_PS;
+      n = LGPGSIZE;
+    } else {
+      // Small pages up to the next 4MB boundary.
+      n = LGPGSIZE - (uint)va % LGPGSIZE;
+      if(n > size)
+        n = size;
+      if(mappages(pgdir, va, n, pa, perm) < 0)
+        return -1;
+    }
+    va += n;
+    pa += n;
+    size -= n;
+  }
+  return 0;
+}
+
+// Set up kernel part of a page table by sharing kpgdir's.
 pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
-  struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kzalloc()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  if (P2V(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
-      freevm(pgdir);
-      return 0;
-    }
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
   return pgdir;
 }
 
 // Allocate one page table for the machine for the kernel address
-// space for scheduler processes.
+// space for scheduler processes.  Its kernel page tables are
+// shared by every process's page table.
 void
 kvmalloc(void)
 {
-  kpgdir = setupkvm();
+  struct kmap *k;
+
+  if (P2V(phystop) > (void*)DEVSPACE)
+    panic("phystop too high");
+  kmap[2].phys_end = phystop;
+  if((kpgdir = (pde_t*)kzalloc()) == 0)
+    panic("kvmalloc");
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+    if(mapkvm(kpgdir, k) < 0)
+      panic("kvmalloc");
   switchkvm();
 }
 
@@ -186,36 +251,11 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kzalloc();
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
 
-// Load a program segment into pgdir.  addr must be page-aligned
-// and the pages from addr to addr+sz must already be mapped.
-int
-loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
-{
-  uint i, pa, n;
-  pte_t *pte;
-
-  if((uint) addr % PGSIZE != 0)
-    panic("loaduvm: addr must be page aligned");
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, addr+i, 0)) == 0)
-      panic("loaduvm: address should exist");
-    pa = PTE_ADDR(*pte);
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, P2V(pa), offset+i, n) != n)
-      return -1;
-  }
-  return 0;
-}
-
 // Allocate page tables and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
 int
@@ -231,13 +271,12 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kzalloc();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -248,19 +287,39 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
+// Free the n pages in pg[], which were just unmapped from the
+// current process's address space, once no TLB can reach them.
+static void
+freeunmapped(char **pg, int n)
+{
+  lcr3(rcr3());
+  tlbshootdown();
+  while(n > 0)
+    kfree(pg[--n]);
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
 // process size.  Returns the new process size.
+// If pgdir is in use by threads on other CPUs, a page is freed only
+// after they have flushed their TLBs, NDEFER pages at a time;
+// until then they could still write to it after kfree() gave it to
+// somebody else.
 int
 deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
+  struct proc *p = myproc();
+  char *defer[NDEFER];
   pte_t *pte;
   uint a, pa;
+  int n, shared;
 
   if(newsz >= oldsz)
     return oldsz;
 
+  shared = p && p->multithreaded && p->pgdir == pgdir;
+  n = 0;
   a = PGROUNDUP(newsz);
   for(; a  < oldsz; a += PGSIZE){
     pte = walkpgdir(pgdir, (char*)a, 0);
@@ -271,15 +330,28 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       if(pa == 0)
         panic("kfree");
       char *v = P2V(pa);
-      kfree(v);
+      *pte = 0;
+      if(!shared){
+        kfree(v);
+        continue;
+      }
+      defer[n++] = v;
+      if(n == NDEFER){
+        freeunmapped(defer, n);
+        n = 0;
+      }
+    } else if(*pte & PTE_SWAP){
+      swapfree(PTE_ADDR(*pte) / PGSIZE);
       *pte = 0;
     }
   }
+  if(n > 0)
+    freeunmapped(defer, n);
   return newsz;
 }
 
 // Free a page table and all the physical memory pages
-// in the user part.
+// in the user part.  The kernel part belongs to kpgdir.
 void
 freevm(pde_t *pgdir)
 {
@@ -288,7 +360,7 @@ freevm(pde_t *pgdir)
   if(pgdir == 0)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
+  for(i = 0; i < PDX(KERNBASE); i++){
     if(pgdir[i] & PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
@@ -297,6 +369,14 @@ freevm(pde_t *pgdir)
   kfree((char*)pgdir);
 }
 
+// Return the PTE for user address va in pgdir, or 0 if it has no
+// page table.
+pte_t*
+uvmpte(pde_t *pgdir, uint va)
+{
+  return walkpgdir(pgdir, (char*)va, 0);
+}
+
 // Clear PTE_U on a page. Used to create an inaccessible
 // page beneath the user stack.
 void
@@ -311,39 +391,466 @@ clearpteu(pde_t *pgdir, char *uva)
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child.  Pages are not copied: both page tables
+// map the same physical pages, and writable pages are made
+// read-only and marked PTE_COW in both, so the first write from
+// either side faults and gets its own copy (see cowpage).
+// PTE_SHARED pages stay writable and shared, and swapped-out pages
+// share their swap slot.  All of user space is copied, including
+// mappings above sz.
+// pgdir must be the current page table.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
-  pte_t *pte;
+  pte_t *pte, *dpte;
   uint pa, i, flags;
-  char *mem;
 
   if((d = setupkvm()) == 0)
     return 0;
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
+  // Mapped regions live above sz, so walk all of user space.
+  for(i = 0; i < KERNBASE; i += PGSIZE){
+    // Heap pages that were never touched have nothing to share.
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if(*pte & PTE_SWAP){
+      if((dpte = walkpgdir(d, (void*)i, 1)) == 0)
+        goto bad;
+      swapdup(PTE_ADDR(*pte) / PGSIZE);
+      *dpte = *pte;
+      continue;
+    }
     if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+      continue;
+    if((*pte & (PTE_W|PTE_SHARED)) == PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
       goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-      kfree(mem);
-      goto bad;
-    }
+    kincref(P2V(pa));
   }
+  // The parent's writable pages just became read-only.
+  lcr3(V2P(pgdir));
   return d;
 
 bad:
+  lcr3(V2P(pgdir));
   freevm(d);
   return 0;
 }
 
+// Give the copy-on-write page mapped by pte a private, writable
+// frame.  If nobody else references the frame any more it is
+// simply made writable again.  The caller flushes the TLB.
+// Returns 0 on success, -1 if out of memory.
+static int
+cowpage(pte_t *pte)
+{
+  char *mem;
+  pte_t old;
+  uint pa;
+
+  old = *pte;
+  if((old & (PTE_P|PTE_COW)) != (PTE_P|PTE_COW))
+    return 0;  // another thread got here first
+  pa = PTE_ADDR(old);
+  if(krefcount(P2V(pa)) == 1){
+    __sync_bool_compare_and_swap(pte, old, (old | PTE_W) & ~PTE_COW);
+    return 0;
+  }
+  if((mem = kallocuser(0)) == 0)
+    return -1;
+  memmove(mem, P2V(pa), PGSIZE);
+  // Allocating may have slept while the other references went
+  // away and the page was swapped out: then the PTE has changed,
+  // and the access is retried.
+  if(!__sync_bool_compare_and_swap(pte, old, V2P(mem) | ((PTE_FLAGS(old) | PTE_W) & ~PTE_COW))){
+    kfree(mem);
+    return 0;
+  }
+  kfree(P2V(pa));
+  return 0;
+}
+
+// Map a zeroed page at va in p, writable if writable is set: the
+// first touch of heap memory that sbrk() handed out without
+// allocating, or of a file mapping past the end of its file part.
+static int
+zeropage(struct proc *p, uint va, int writable)
+{
+  char *mem;
+  int r;
+
+  if((mem = kallocuser(1)) == 0)
+    return -1;
+  if((r = setpte(p->pgdir, PGROUNDDOWN(va), V2P(mem), PTE_U | (writable ? PTE_W : 0))) <= 0)
+    kfree(mem);
+  return r < 0 ? -1 : 0;
+}
+
+// The vma of p containing va, or 0.
+static struct vma*
+findvma(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  for(v = p->vm->vma; v < &p->vm->vma[NVMA]; v++)
+    if(v->type != VMA_NONE && va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Map the page of the private file mapping v containing va in p.
+// A page with file contents is the image cache's copy (imgcache.c),
+// shared with every process mapping the same part of the file, and
+// copy-on-write if v is writable; a page past the end of the file
+// part is a private zero page.
+static int
+filepage(struct proc *p, struct vma *v, uint va)
+{
+  char *mem;
+  uint a, n;
+  int r;
+
+  a = PGROUNDDOWN(va);
+  if(a - v->start >= v->filesz)
+    return zeropage(p, a, v->writable);
+  n = v->filesz - (a - v->start);
+  if(n > PGSIZE)
+    n = PGSIZE;
+  if((mem = imgget(v->ip, v->off + (a - v->start), n)) == 0)
+    return -1;
+  if((r = setpte(p->pgdir, a, V2P(mem), PTE_U | (v->writable ? PTE_COW : 0))) <= 0)
+    kfree(mem);
+  return r < 0 ? -1 : 0;
+}
+
+// Map the page of the MAP_SHARED file mapping v containing va in p:
+// the file page cache's copy, shared with every other mapping.
+static int
+sharedfilepage(struct proc *p, struct vma *v, uint va)
+{
+  char *mem;
+  uint a;
+  int r;
+
+  a = PGROUNDDOWN(va);
+  if((mem = fcacheget(v->ip, v->off + (a - v->start))) == 0)
+    return -1;
+  r = setpte(p->pgdir, a, V2P(mem), PTE_U | PTE_SHARED | (v->writable ? PTE_W : 0));
+  if(r <= 0)
+    kfree(mem);
+  return r < 0 ? -1 : 0;
+}
+
+static int faultin(struct proc*, struct vma*, uint, uint);
+
+// Handle a page fault at user virtual address va in the current
+// process; err is the hardware error code.  Kernel code can fault
+// here too, when a system call touches a page that is not loaded
+// yet or writes to a copy-on-write page.  Loading a file page may
+// sleep, so the kernel must not fault while holding a spinlock;
+// argptr() faults user buffers in up front for that reason.
+// Returns 0 if the faulting instruction can be restarted, -1 if
+// the access is invalid or memory ran out.
+int
+pagefault(uint va, uint err)
+{
+  struct proc *curproc = myproc();
+  struct vma *v, copy;
+  int r;
+
+  if(va >= KERNBASE)
+    return -1;
+  // Another thread may unmap a vma while this one faults on it, so
+  // a multithreaded process works on a copy with its own references.
+  if(curproc->multithreaded)
+    v = vmacopy(va, &copy) ? &copy : 0;
+  else
+    v = findvma(curproc, va);
+  r = faultin(curproc, v, va, err);
+  if(v == &copy)
+    vmaclose(&copy);
+  return r;
+}
+
+// Fix up the fault at va in curproc; v is the vma containing va,
+// if any.  Threads of the process may be faulting on the same page
+// at once: pages are mapped with compare-and-swap (setpte), and the
+// loser of a race drops its page and restarts the access.
+static int
+faultin(struct proc *curproc, struct vma *v, uint va, uint err)
+{
+  pte_t *pte;
+  int r, locked;
+
+  // Below sz is the program and its heap; above it, only vmas.
+  if(v == 0 && va >= curproc->vm->sz)
+    return -1;
+  pte = walkpgdir(curproc->pgdir, (char*)va, 0);
+  if(pte && (*pte & PTE_SWAP)){
+    if(swapin(pte) < 0){
+      cprintf("pid %d %s: out of memory on swap-in\n",
+              curproc->pid, curproc->name);
+      return -1;
+    }
+    curproc->nfault++;
+    return 0;
+  }
+  if(pte == 0 || (*pte & PTE_P) == 0){
+    if(v == 0)
+      r = zeropage(curproc, va, 1);
+    else if(v->type != VMA_FILE)
+      r = -1;  // shared memory is mapped up front
+    else if(v->shared)
+      r = sharedfilepage(curproc, v, va);
+    else
+      r = filepage(curproc, v, va);
+    if(r < 0){
+      cprintf("pid %d %s: cannot load page at 0x%x\n",
+              curproc->pid, curproc->name, va);
+      return -1;
+    }
+    curproc->nfault++;
+    // The first fault after exec() is the fetch of the first
+    // instruction.
+    if(curproc->execns){
+      kstatadd(KSTAT_EXECNS, (uint)(nsclock() - curproc->execns));
+      curproc->execns = 0;
+    }
+    return 0;
+  }
+  if((*pte & (PTE_P|PTE_U)) != (PTE_P|PTE_U))
+    return -1;
+  if((err & FEC_WR) && (*pte & PTE_COW)){
+    // A fork() in another thread must not share the page meanwhile.
+    locked = vmbegin();
+    r = cowpage(pte);
+    vmend(locked);
+    if(r < 0){
+      cprintf("pid %d %s: out of memory on copy-on-write\n",
+              curproc->pid, curproc->name);
+      return -1;
+    }
+    invlpg((void*)PGROUNDDOWN(va));
+    tlbshootdown();
+    curproc->nfault++;
+    return 0;
+  }
+  return -1;
+}
+
+// Fault in any missing pages of [va, va+len) in the current process.
+// System calls use this on user buffers before touching them, so
+// that running out of memory fails the call instead of faulting
+// in the kernel with no way to recover.
+int
+touchuvm(uint va, uint len)
+{
+  struct proc *curproc = myproc();
+  pte_t *pte;
+  uint a, last;
+
+  if(len == 0)
+    return 0;
+  a = PGROUNDDOWN(va);
+  last = PGROUNDDOWN(va + len - 1);
+  for(;; a += PGSIZE){
+    pte = walkpgdir(curproc->pgdir, (char*)a, 0);
+    if((pte == 0 || (*pte & PTE_P) == 0) && pagefault(a, 0) < 0)
+      return -1;
+    if(a == last)
+      break;
+  }
+  return 0;
+}
+
+// Map the n pages in pages[] at va in pgdir, writable and shared
+// (PTE_SHARED), taking a reference on each.
+int
+mapshared(pde_t *pgdir, uint va, char **pages, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(mappages(pgdir, (char*)va + i*PGSIZE, PGSIZE, V2P(pages[i]),
+                PTE_W|PTE_U|PTE_SHARED) < 0){
+      deallocuvm(pgdir, va + i*PGSIZE, va);
+      return -1;
+    }
+    kincref(pages[i]);
+  }
+  return 0;
+}
+
+// Return a free vma slot in p, or 0.
+struct vma*
+vmaalloc(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vm->vma; v < &p->vm->vma[NVMA]; v++)
+    if(v->type == VMA_NONE)
+      return v;
+  return 0;
+}
+
+// Does any vma of p overlap [start, end)?
+int
+vmaoverlap(struct proc *p, uint start, uint end)
+{
+  struct vma *v;
+
+  for(v = p->vm->vma; v < &p->vm->vma[NVMA]; v++)
+    if(v->type != VMA_NONE && v->start < end && v->end > start)
+      return 1;
+  return 0;
+}
+
+// Find room for a len-byte mapping between the heap and KERNBASE,
+// as high as possible so that the heap can keep growing.
+// Returns its address, or 0 if there is no room.
+uint
+vmaspace(struct proc *p, uint len)
+{
+  struct vma *v;
+  uint end;
+
+  len = PGROUNDUP(len);
+  end = KERNBASE;
+again:
+  if(end < len || end - len < PGROUNDUP(p->vm->sz))
+    return 0;
+  for(v = p->vm->vma; v < &p->vm->vma[NVMA]; v++){
+    if(v->type != VMA_NONE && v->start < end && v->end > end - len){
+      end = v->start;
+      goto again;
+    }
+  }
+  return end - len;
+}
+
+// Remove v's pages from pgdir.  Dirty pages of a shared file
+// mapping are written back to the file first.  The caller flushes
+// its own TLB if pgdir is in use; deallocuvm() has flushed those of
+// other threads.
+void
+vmaunmap(pde_t *pgdir, struct vma *v)
+{
+  pte_t *pte;
+  uint a;
+
+  if(v->type == VMA_FILE && v->shared){
+    for(a = v->start; a < v->end; a += PGSIZE){
+      pte = walkpgdir(pgdir, (char*)a, 0);
+      if(pte && (*pte & (PTE_P|PTE_D)) == (PTE_P|PTE_D))
+        fpagewrite(v->ip, v->off + (a - v->start), P2V(PTE_ADDR(*pte)));
+    }
+  }
+  deallocuvm(pgdir, v->end, v->start);
+  if(v->type == VMA_FILE && v->shared)
+    fcacherelease(v->ip);
+}
+
+// Take the references a copy of v needs (fork).
+void
+vmadup(struct vma *v)
+{
+  if(v->type == VMA_FILE){
+    idup(v->ip);
+    if(v->text)
+      itext(v->ip, 1);
+  } else if(v->type == VMA_SHM)
+    shmdup(v->shmid);
+}
+
+// Drop v's references and free the slot.  The pages stay mapped
+// until the caller clears them (or the page table is freed).
+void
+vmaclose(struct vma *v)
+{
+  if(v->type == VMA_FILE){
+    if(v->text)
+      itext(v->ip, -1);
+    begin_op();
+    iput(v->ip);
+    end_op();
+  } else if(v->type == VMA_SHM)
+    shmrelease(v->shmid);
+  memset(v, 0, sizeof(*v));
+}
+
+// Is [va, va+len) user memory of p: below sz, or inside one vma?
+// If write is set, it must also be writable; everything below sz is.
+int
+uvmvalid(struct proc *p, uint va, uint len, int write)
+{
+  struct vma *v;
+
+  if(va + len < va)
+    return 0;
+  if(va + len <= p->vm->sz)
+    return 1;
+  for(v = p->vm->vma; v < &p->vm->vma[NVMA]; v++)
+    if(v->type != VMA_NONE && va >= v->start && va + len <= v->end)
+      return !write || v->writable;
+  return 0;
+}
+
+// Advance a clock hand *va over the user pages of pgdir, looking
+// for a page that swapping may evict: present, mapped only here,
+// and not accessed since the hand last passed (PTE_A clear).  The
+// hand clears PTE_A on the pages it passes over.  Returns the
+// page's PTE, with *va at the page, or 0 at the end of user space.
+pte_t*
+clockscan(pde_t *pgdir, uint *va)
+{
+  pte_t *pte;
+  uint a;
+
+  for(a = *va; a < KERNBASE; a += PGSIZE){
+    if((pte = walkpgdir(pgdir, (char*)a, 0)) == 0){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if((*pte & (PTE_P|PTE_U|PTE_SHARED)) != (PTE_P|PTE_U))
+      continue;
+    if(krefcount(P2V(PTE_ADDR(*pte))) != 1)
+      continue;
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      continue;
+    }
+    *va = a;
+    return pte;
+  }
+  *va = a;
+  return 0;
+}
+
+// Number of user pages below sz that are backed by physical memory.
+int
+uvmresident(pde_t *pgdir, uint sz)
+{
+  pte_t *pte;
+  uint a;
+  int n;
+
+  n = 0;
+  for(a = 0; a < sz; a += PGSIZE){
+    if((pte = walkpgdir(pgdir, (char*)a, 0)) == 0){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if(*pte & PTE_P)
+      n++;
+  }
+  return n;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
@@ -362,15 +869,25 @@ uva2ka(pde_t *pgdir, char *uva)
 // Copy len bytes from p to user address va in page table pgdir.
 // Most useful when pgdir is not the current page table.
 // uva2ka ensures this only works for PTE_U pages.
+// Copy-on-write pages are unshared first, since the copy goes
+// through the kernel mapping and would bypass the fault.
 int
 copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    pte = walkpgdir(pgdir, (char*)va0, 0);
+    if(pte && (*pte & PTE_P) && (*pte & PTE_COW)){
+      if(cowpage(pte) < 0)
+        return -1;
+      if(pgdir == myproc()->pgdir)
+        invlpg((void*)va0);
+    }
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;
@@ -385,6 +902,43 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
   return 0;
 }
 
+// Copy the nul-terminated string at user address va in the current
+// process into buf, at most max bytes with the nul.  Missing pages
+// are faulted in, and the string is read through the kernel's
+// mapping of each page, so another thread that unmaps the page
+// meanwhile cannot make the kernel fault.  Returns the length of
+// the string, or -1.
+int
+copyinstr(char *buf, uint va, uint max)
+{
+  pde_t *pgdir = myproc()->pgdir;
+  pte_t *pte, e;
+  char *src;
+  uint n, va0;
+
+  n = 0;
+  while(n < max){
+    va0 = PGROUNDDOWN(va);
+    if(va0 >= KERNBASE)
+      return -1;
+    for(;;){
+      pte = walkpgdir(pgdir, (char*)va0, 0);
+      if(pte && ((e = *pte) & PTE_P))
+        break;
+      if(pagefault(va0, 0) < 0)
+        return -1;
+    }
+    if((e & PTE_U) == 0)
+      return -1;
+    src = (char*)P2V(PTE_ADDR(e)) + (va - va0);
+    for(; va < va0 + PGSIZE && n < max; va++, n++){
+      if((buf[n] = *src++) == 0)
+        return n;
+    }
+  }
+  return -1;
+}
+
 //PAGEBREAK!
 // Blank page.
 //PAGEBREAK!
@@ -0,0 +1,12 @@
+// An address space: a page table and the layout of the user memory
+// it maps.  A process shares its address space with the threads it
+// clone()s and lends it to a vfork() child; they all point at the
+// same struct vmspace.  While it is shared, changes to sz and vma[]
+// are serialized by lock (vmbegin()).  pgdir does not change.
+struct vmspace {
+  struct sleeplock lock;       // Held while sz or vma[] change
+  int ref;                     // Processes using it
+  pde_t *pgdir;                // Page table
+  uint sz;                     // Size of process memory (bytes)
+  struct vma vma[NVMA];        // File-backed and shared memory
+};
@@ -130,6 +130,21 @@ xchg(volatile uint *addr, uint newval)
   return result;
 }
 
+// Spin-wait hint: lets the CPU back off while polling a lock word.
+static inline void
+pause(void)
+{
+  asm volatile("pause");
+}
+
+static inline uint64
+rdtsc(void)
+{
+  uint64 tsc;
+  asm volatile("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
 static inline uint
 rcr2(void)
 {
@@ -144,6 +159,21 @@ lcr3(uint val)
   asm volatile("movl %0,%%cr3" : : "r" (val));
 }
 
+static inline uint
+rcr3(void)
+{
+  uint val;
+  asm volatile("movl %%cr3,%0" : "=r" (val));
+  return val;
+}
+
+// Flush the TLB entry for one virtual address.
+static inline void
+invlpg(void *va)
+{
+  asm volatile("invlpg (%0)" : : "r" (va) : "memory");
+}
+
 //PAGEBREAK: 36
 // Layout of the trap frame built on the stack by the
 // hardware and by trapasm.S, and passed to trap().